@@ -0,0 +1,112 @@
+#include <stdlib.h>
+#include <string.h>
+#include "chip8.h"
+
+/*
+AOT engine: runs the basic blocks chip8-aot compiled from one ROM into C
+and linked into the binary (chip8->aot_program). A compiled block is only
+used while the RAM it was compiled from is untouched: any write to a page
+holding compiled code retires that page for the rest of the run, and
+addresses without a usable block (computed jumps into code chip8-aot
+didn't find, self-modified regions, the tail of an instruction budget
+shorter than the block) go through execute_instruction().
+*/
+
+typedef struct aot_cache{
+    const aot_block *entries[RAM_SIZE]; //Compiled block starting at each address, NULL = interpret
+    __uint8_t code_pages[CODE_PAGES]; //Pages some compiled block was read from
+    __uint8_t stale_pages[CODE_PAGES]; //Code pages written since the ROM was loaded
+} aot_cache;
+
+int initialize_aot(chip8 *chip8_object_ptr){
+    const aot_program *program = chip8_object_ptr->aot_program;
+
+    if(chip8_object_ptr->aot) return 1;
+    if(!program || program->rom_size > MAX_ROM_SIZE) return 0;
+
+    //The blocks call the handlers of the profile they were compiled for
+    if(program->quirks != chip8_object_ptr->quirks) return 0;
+
+    //The blocks were compiled from a freshly loaded RAM image, anything else would run the wrong code
+    if(memcmp(chip8_object_ptr->RAM + PROGRAM_START, program->rom, program->rom_size)) return 0;
+    for(size_t i=PROGRAM_START + program->rom_size; i<RAM_SIZE; i++){
+        if(chip8_object_ptr->RAM[i]) return 0;
+    }
+
+    aot_cache *cache = calloc(1, sizeof(aot_cache));
+    if(!cache){
+        printf("Error allocating AOT cache\n");
+        exit(1);
+    }
+
+    for(size_t i=0; i<program->block_count; i++){
+        const aot_block *current = &program->blocks[i];
+
+        cache->entries[current->start & (RAM_SIZE - 1)] = current;
+        for(int j=0; j<2 * current->length; j++){
+            cache->code_pages[((current->start + j) & (RAM_SIZE - 1)) / CODE_PAGE_SIZE] = 1;
+        }
+    }
+
+    chip8_object_ptr->aot = cache;
+    return 1;
+}
+
+void destroy_aot(chip8 *chip8_object_ptr){
+    free(chip8_object_ptr->aot);
+    chip8_object_ptr->aot = NULL;
+}
+
+static void retire_written_pages(chip8 *chip8_object_ptr){
+    aot_cache *cache = chip8_object_ptr->aot;
+
+    for(int page=chip8_object_ptr->first_written_page; page<=chip8_object_ptr->last_written_page; page++){
+        if(chip8_object_ptr->written_pages[page / 8] & (1 << (page % 8))){
+            cache->stale_pages[page] |= cache->code_pages[page];
+        }
+    }
+
+    clear_written_pages(chip8_object_ptr);
+}
+
+//A block is at most 2 * BLOCK_MAX_LENGTH bytes, no longer than a page, so it touches two pages at most
+static int block_is_stale(const aot_cache *cache, const aot_block *current){
+    return cache->stale_pages[(current->start & (RAM_SIZE - 1)) / CODE_PAGE_SIZE]
+        || cache->stale_pages[((current->start + 2 * current->length - 1) & (RAM_SIZE - 1)) / CODE_PAGE_SIZE];
+}
+
+long execute_aot(chip8 *chip8_object_ptr, long count){
+    aot_cache *cache = chip8_object_ptr->aot;
+    const long budget = count;
+
+    while(count > 0 && chip8_object_ptr->state == RUNNING){
+        if(chip8_object_ptr->pages_written){
+            retire_written_pages(chip8_object_ptr);
+        }
+
+        if(IDLE_LOOP_CANDIDATE(chip8_object_ptr)){
+            long skipped = skip_idle_loop(chip8_object_ptr, count);
+
+            if(skipped){
+                count -= skipped;
+                continue;
+            }
+        }
+
+        const aot_block *current = cache->entries[chip8_object_ptr->PC & (RAM_SIZE - 1)];
+
+        if(!current || current->start != chip8_object_ptr->PC || current->length > count
+           || block_is_stale(cache, current)){
+            execute_instruction(chip8_object_ptr);
+            count--;
+            continue;
+        }
+
+        current->code(chip8_object_ptr);
+        if(chip8_object_ptr->profile){
+            profile_block(chip8_object_ptr->profile, current->ops, current->start, current->length);
+        }
+        count -= current->length;
+    }
+    return budget - count;
+}
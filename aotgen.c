@@ -0,0 +1,224 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "chip8.h"
+
+/*
+chip8-aot: static recompiler. Loads a ROM the way the emulator does, follows
+its control flow from 0x200 and writes a C file with one function per basic
+block. Blocks end where the block engine ends them (block_terminator()) and
+each one calls the same handlers execute_instruction() would, with the
+operands decoded at compile time for the quirk profile given with
+--quirks; the program only runs with that profile. Targets that can't be known statically
+(Bnnn, return addresses chip8-aot never saw a call for) are left to the
+interpreter at run time, see aot.c.
+*/
+
+typedef struct{
+    __uint16_t start;
+    __uint8_t length;
+    instruction ops[BLOCK_MAX_LENGTH];
+} compiled_block;
+
+static compiled_block *blocks[RAM_SIZE]; //Block starting at each address, found by the walk
+
+void usage(void){
+    printf("Usage: ./chip8-aot [-o output.c] [--quirks default|vip|schip|xo] <rom name>\n");
+    exit(1);
+}
+
+const char *name_of(handler_fn handler){
+    int index = handler_index(handler);
+
+    if(index < 0){
+        printf("Handler missing from handler_names\n");
+        exit(1);
+    }
+    return handler_names[index].name;
+}
+
+//Blocks stop at the end of the ROM, execution past it is left to the interpreter
+compiled_block *compile_block(chip8 *chip8_object_ptr, __uint16_t start, int end){
+    compiled_block *new_block = calloc(1, sizeof(compiled_block));
+    if(!new_block){
+        printf("Out of memory\n");
+        exit(1);
+    }
+
+    new_block->start = start;
+
+    for(int address=start; address < end && new_block->length < BLOCK_MAX_LENGTH; address += 2){
+        const instruction *ins = decode_instruction(chip8_object_ptr, address);
+
+        new_block->ops[new_block->length++] = *ins;
+        if(block_terminator(ins->handler)) break;
+    }
+    return new_block;
+}
+
+//Where execution can continue after a block, targets only known at run time aren't listed
+int successors(chip8 *chip8_object_ptr, const compiled_block *current, int *next){
+    return instruction_successors(chip8_object_ptr, current->start + 2 * (current->length - 1), next);
+}
+
+/*
+Only code in the ROM image is compiled, like find_code() in romcache.c
+does: zeroed RAM a fall-through or wild jump reaches is run by the
+interpreter fallback in aot.c.
+*/
+void walk(chip8 *chip8_object_ptr){
+    static __uint16_t pending[RAM_SIZE];
+    int pending_count = 0;
+    int end = PROGRAM_START + chip8_object_ptr->rom_size - 1; //Last byte of the ROM, an instruction has to start before it
+
+    pending[pending_count++] = PROGRAM_START;
+
+    while(pending_count){
+        __uint16_t start = pending[--pending_count];
+        int next[2];
+
+        if(blocks[start]) continue;
+        blocks[start] = compile_block(chip8_object_ptr, start, end);
+
+        int count = successors(chip8_object_ptr, blocks[start], next);
+        for(int i=0; i<count; i++){
+            if(next[i] < PROGRAM_START || next[i] >= end || blocks[next[i]]) continue;
+            pending[pending_count++] = next[i];
+        }
+    }
+}
+
+void emit(FILE *out, const char *rom_name, const __uint8_t *rom, size_t rom_size, quirk_profiles quirks){
+    fprintf(out, "/*\n"
+                 "Generated by chip8-aot from %s, do not edit.\n"
+                 "Build it into the frontend with `make native AOT_ROM=...` and run with --engine aot.\n"
+                 "*/\n\n"
+                 "#include \"chip8.h\"\n\n", rom_name);
+
+    fprintf(out, "static const __uint8_t rom[] = {");
+    for(size_t i=0; i<rom_size; i++){
+        fprintf(out, "%s0x%02X,", (i % 12) ? " " : "\n    ", rom[i]);
+    }
+    fprintf(out, "\n};\n");
+
+    for(int start=0; start<RAM_SIZE; start++){
+        compiled_block *current = blocks[start];
+        if(!current) continue;
+
+        fprintf(out, "\nstatic const instruction ops_%03X[] = {\n", start);
+        for(int i=0; i<current->length; i++){
+            const instruction *ins = &current->ops[i];
+            fprintf(out, "    {%s, 0x%04X, 0x%03X, 0x%02X, 0x%X, 0x%X, 0x%X, %u},\n",
+                name_of(ins->handler), ins->opcode, ins->nnn, ins->nn, ins->n, ins->x, ins->y, ins->opclass);
+        }
+        fprintf(out, "};\n\n");
+
+        //Only the last instruction can read PC, see block_terminator()
+        fprintf(out, "static void block_%03X(chip8 *chip8_object_ptr){\n", start);
+        for(int i=0; i<current->length; i++){
+            if(i == current->length - 1){
+                fprintf(out, "    chip8_object_ptr->PC = 0x%03X;\n", (start + 2 * i + 2) & (RAM_SIZE - 1));
+            }
+            fprintf(out, "    %s(chip8_object_ptr, &ops_%03X[%d]);\n", name_of(current->ops[i].handler), start, i);
+        }
+        fprintf(out, "}\n");
+    }
+
+    fprintf(out, "\nstatic const aot_block blocks[] = {\n");
+    for(int start=0; start<RAM_SIZE; start++){
+        if(!blocks[start]) continue;
+        fprintf(out, "    {0x%03X, %u, ops_%03X, block_%03X},\n", start, blocks[start]->length, start, start);
+    }
+    fprintf(out, "};\n\n");
+
+    fprintf(out, "const aot_program aot_builtin_program = {\n    \"");
+    for(const char *c=rom_name; *c; c++){
+        if(*c == '"' || *c == '\\') fputc('\\', out);
+        fputc(*c, out);
+    }
+    fprintf(out, "\",\n    rom,\n    sizeof rom,\n    blocks,\n    sizeof blocks / sizeof blocks[0],\n    %d, //%s quirks\n};\n",
+        quirks, quirk_profile_name(quirks));
+}
+
+int main(int argc, char **argv){
+    const char *rom_name = NULL;
+    const char *out_name = NULL;
+    int quirks = QUIRKS_DEFAULT;
+
+    for(int i=1; i<argc; i++){
+        if(!strcmp(argv[i], "-o") && i + 1 < argc){
+            out_name = argv[++i];
+        }else if(!strcmp(argv[i], "--quirks") && i + 1 < argc){
+            quirks = quirk_profile_from_name(argv[++i]);
+            if(quirks < 0){
+                printf("Unknown quirk profile: %s\n", argv[i]);
+                exit(1);
+            }
+        }else if(argv[i][0] != '-' && !rom_name){
+            rom_name = argv[i];
+        }else{
+            usage();
+        }
+    }
+
+    if(!rom_name){
+        usage();
+    }
+
+    FILE *rom = fopen(rom_name, "rb");
+    if(rom == NULL){
+        printf("Error opening ROM\n");
+        exit(1);
+    }
+
+    //Keep the raw bytes for the generated file, the loaded copy is what the walk decodes
+    static __uint8_t rom_bytes[MAX_ROM_SIZE];
+    size_t rom_size = fread(rom_bytes, 1, sizeof rom_bytes, rom);
+    rewind(rom);
+
+    //Without a whole instruction there's nothing to compile, and the generated arrays would be empty
+    if(rom_size < 2){
+        printf("ROM holds no instructions\n");
+        exit(1);
+    }
+
+    chip8 *chip8_object_ptr = malloc(sizeof *chip8_object_ptr);
+    if(!chip8_object_ptr){
+        printf("Out of memory\n");
+        exit(1);
+    }
+    initialize_chip8(chip8_object_ptr, rom);
+    fclose(rom);
+    set_quirks(chip8_object_ptr, quirks);
+
+    walk(chip8_object_ptr);
+
+    FILE *out = stdout;
+    if(out_name){
+        out = fopen(out_name, "w");
+        if(out == NULL){
+            printf("Error creating %s\n", out_name);
+            exit(1);
+        }
+    }
+
+    emit(out, rom_name, rom_bytes, rom_size, quirks);
+
+    int block_count = 0;
+    int instruction_count = 0;
+    for(int i=0; i<RAM_SIZE; i++){
+        if(!blocks[i]) continue;
+        block_count++;
+        instruction_count += blocks[i]->length;
+        free(blocks[i]);
+    }
+
+    if(out != stdout){
+        fclose(out);
+        printf("%s: %d blocks, %d instructions\n", out_name, block_count, instruction_count);
+    }
+
+    destroy_chip8(chip8_object_ptr);
+    free(chip8_object_ptr);
+    return 0;
+}
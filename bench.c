@@ -0,0 +1,408 @@
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "chip8.h"
+
+/*
+Benchmarks for the core, built without SDL and with optimisation by
+`make bench`. Three groups, each run on every engine:
+- opcode: a loop of BENCH_BODY copies of one instruction, so the dispatch
+  and the handler dominate. Dxyn and Fx55/Fx65 come in several sizes.
+- rom: small synthetic programs shaped like real ones (sprite drawing,
+  ALU work, memory copies, self-modifying code), plus any ROM files
+  given on the command line.
+Every measurement is repeated with twice the work until it takes at least
+--time seconds. Results are one JSON document on stdout (or -o FILE).
+*/
+
+//Copies of the measured instruction per loop iteration
+#define BENCH_BODY 32
+
+//Where the opcode loops keep scratch data for I-relative instructions, away from the code
+#define BENCH_DATA 0x800
+
+typedef enum{
+    BODY_REPEAT, //The opcode as is
+    BODY_JUMP_NEXT, //The opcode plus the address of the following instruction
+    BODY_CALL //A call to a subroutine that only returns
+} body_kind;
+
+typedef struct{
+    const char *name;
+    __uint16_t opcode;
+    body_kind kind;
+} opcode_bench;
+
+static const opcode_bench opcode_benches[] = {
+    {"00e0", 0x00E0, BODY_REPEAT},
+    {"1nnn", 0x1000, BODY_JUMP_NEXT},
+    {"2nnn_00ee", 0x2000, BODY_CALL},
+    {"3xnn", 0x3001, BODY_REPEAT}, //V0 = 0, never skips
+    {"4xnn", 0x4000, BODY_REPEAT},
+    {"5xy0", 0x5010, BODY_REPEAT}, //V0 != V1
+    {"6xnn", 0x6A42, BODY_REPEAT},
+    {"7xnn", 0x7A01, BODY_REPEAT},
+    {"8xy0", 0x8A30, BODY_REPEAT},
+    {"8xy1", 0x8A31, BODY_REPEAT},
+    {"8xy2", 0x8A32, BODY_REPEAT},
+    {"8xy3", 0x8A33, BODY_REPEAT},
+    {"8xy4", 0x8A34, BODY_REPEAT},
+    {"8xy5", 0x8A35, BODY_REPEAT},
+    {"8xy6", 0x8A36, BODY_REPEAT},
+    {"8xy7", 0x8A37, BODY_REPEAT},
+    {"8xye", 0x8A3E, BODY_REPEAT},
+    {"9xy0", 0x9020, BODY_REPEAT}, //V0 == V2
+    {"annn", 0xA800, BODY_REPEAT},
+    {"bnnn", 0xB000, BODY_JUMP_NEXT},
+    {"cxnn", 0xCAFF, BODY_REPEAT},
+    {"dxyn_1", 0xD011, BODY_REPEAT},
+    {"dxyn_5", 0xD015, BODY_REPEAT},
+    {"dxyn_15", 0xD01F, BODY_REPEAT},
+    {"ex9e", 0xE09E, BODY_REPEAT}, //No key held, never skips
+    {"fx07", 0xFA07, BODY_REPEAT},
+    {"fx15", 0xF315, BODY_REPEAT},
+    {"fx18", 0xF318, BODY_REPEAT},
+    {"fx1e", 0xF31E, BODY_REPEAT},
+    {"fx29", 0xF329, BODY_REPEAT},
+    {"fx33", 0xF333, BODY_REPEAT},
+    {"fx55_1", 0xF055, BODY_REPEAT},
+    {"fx55_8", 0xF755, BODY_REPEAT},
+    {"fx55_16", 0xFF55, BODY_REPEAT},
+    {"fx65_1", 0xF065, BODY_REPEAT},
+    {"fx65_8", 0xF765, BODY_REPEAT},
+    {"fx65_16", 0xFF65, BODY_REPEAT},
+};
+
+//Sprites: draws 8 font glyphs in a diagonal, then clears and starts over
+static const __uint16_t rom_sprites[] = {
+    0x00E0, //200: CLS
+    0x6000, //202: V0 = 0
+    0x6100, //204: V1 = 0
+    0x6208, //206: V2 = 8
+    0xF329, //208: I = glyph V3
+    0xD015, //20A: draw at V0, V1
+    0x7008, //20C: V0 += 8
+    0x7104, //20E: V1 += 4
+    0x72FF, //210: V2 -= 1
+    0x3200, //212: skip if V2 == 0
+    0x120A, //214: jump 20A
+    0x7301, //216: V3 += 1
+    0x1200, //218: jump 200
+};
+
+//ALU: register arithmetic and shifts in a tight loop
+static const __uint16_t rom_alu[] = {
+    0x6001, //200: V0 = 1
+    0x6103, //202: V1 = 3
+    0x8014, //204: V0 += V1
+    0x8102, //206: V1 &= V0
+    0x8013, //208: V0 ^= V1
+    0x8106, //20A: V1 >>= 1
+    0x800E, //20C: V0 <<= 1
+    0x7107, //20E: V1 += 7
+    0x8015, //210: V0 -= V1
+    0x8011, //212: V0 |= V1
+    0x1204, //214: jump 204
+};
+
+//Memory: copies all 16 registers between two buffers
+static const __uint16_t rom_memory[] = {
+    0xA300, //200: I = 300
+    0xFF65, //202: load V0-VF
+    0xA400, //204: I = 400
+    0xFF55, //206: store V0-VF
+    0x7001, //208: V0 += 1
+    0x1200, //20A: jump 200
+};
+
+//Self-modifying: rewrites the operand of the instruction at 20A every iteration
+static const __uint16_t rom_smc[] = {
+    0x6000, //200: V0 = 0
+    0x7001, //202: V0 += 1
+    0xA20B, //204: I = 20B, the low byte of 20A
+    0xF055, //206: RAM[20B] = V0
+    0x6200, //208: V2 = 0
+    0x6100, //20A: V1 = NN, rewritten above
+    0x8114, //20C: V1 += V1
+    0x1202, //20E: jump 202
+};
+
+typedef struct{
+    const char *name;
+    const __uint16_t *code;
+    size_t length;
+} rom_bench;
+
+static const rom_bench rom_benches[] = {
+    {"sprites", rom_sprites, sizeof rom_sprites / sizeof rom_sprites[0]},
+    {"alu", rom_alu, sizeof rom_alu / sizeof rom_alu[0]},
+    {"memory", rom_memory, sizeof rom_memory / sizeof rom_memory[0]},
+    {"self_modifying", rom_smc, sizeof rom_smc / sizeof rom_smc[0]},
+};
+
+static const char *engine_names[] = {
+    [ENGINE_INTERPRETER] = "interpreter",
+    [ENGINE_BLOCK] = "block",
+    [ENGINE_JIT] = "jit",
+};
+
+static double min_seconds = 0.05;
+static FILE *out;
+static int results; //JSON objects written so far, for the separators
+
+double elapsed_seconds(struct timespec *start, struct timespec *end){
+    return (end->tv_sec - start->tv_sec) + (end->tv_nsec - start->tv_nsec) / 1e9;
+}
+
+void usage(void){
+    printf("Usage: ./chip8-bench [--engine interpreter|block|jit] [--time SECONDS] [-o FILE] [rom ...]\n");
+    exit(1);
+}
+
+//initialize_chip8() loads from a FILE, hand it the program through a temporary one
+void load_program(chip8 *chip8_object_ptr, const __uint8_t *program, size_t len, engines engine){
+    FILE *rom = tmpfile();
+
+    if(rom == NULL){
+        printf("Error creating temporary ROM\n");
+        exit(1);
+    }
+    fwrite(program, 1, len, rom);
+    rewind(rom);
+
+    initialize_chip8(chip8_object_ptr, rom);
+    fclose(rom);
+    set_engine(chip8_object_ptr, engine);
+    seed_chip8(chip8_object_ptr, 1);
+}
+
+size_t put_opcode(__uint8_t *program, size_t pc, __uint16_t opcode){
+    program[pc - 0x200] = opcode >> 8;
+    program[pc - 0x200 + 1] = opcode & 0xff;
+    return pc + 2;
+}
+
+//Setup, BENCH_BODY copies of the opcode, a jump back to the first copy; returns the length in bytes
+size_t build_opcode_program(const opcode_bench *bench, __uint8_t *program){
+    static const __uint16_t setup[] = {
+        0x6000, 0x6101, 0x6200, 0x6305, //V0 = 0, V1 = 1, V2 = 0, V3 = 5
+        0xA000 | BENCH_DATA,
+    };
+    size_t pc = 0x200;
+
+    for(size_t i=0; i<sizeof setup / sizeof setup[0]; i++){
+        pc = put_opcode(program, pc, setup[i]);
+    }
+
+    __uint16_t loop = pc;
+    __uint16_t subroutine = loop + BENCH_BODY * 2 + 2;
+
+    for(int i=0; i<BENCH_BODY; i++){
+        switch(bench->kind){
+            case BODY_REPEAT:
+                pc = put_opcode(program, pc, bench->opcode);
+                break;
+            case BODY_JUMP_NEXT:
+                pc = put_opcode(program, pc, bench->opcode | (pc + 2));
+                break;
+            case BODY_CALL:
+                pc = put_opcode(program, pc, bench->opcode | subroutine);
+                break;
+        }
+    }
+    pc = put_opcode(program, pc, 0x1000 | loop);
+    pc = put_opcode(program, pc, 0x00EE);
+
+    return pc - 0x200;
+}
+
+//Runs count instructions, doubling count until it takes min_seconds; returns the seconds of the last run
+double time_instructions(chip8 *chip8_object_ptr, long *count){
+    struct timespec start, end;
+    double seconds;
+
+    *count = 1 << 14;
+    for(;;){
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        execute_instructions(chip8_object_ptr, *count);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+
+        seconds = elapsed_seconds(&start, &end);
+        if(seconds >= min_seconds) return seconds;
+        *count *= 2;
+    }
+}
+
+//Same for whole frames at the default instruction rate, timers and frame bookkeeping included
+double time_frames(chip8 *chip8_object_ptr, long *count){
+    struct timespec start, end;
+    double seconds;
+
+    *count = 1 << 10;
+    for(;;){
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for(long i=0; i<*count; i++){
+            run_frame(chip8_object_ptr, DEFAULT_IPS);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+
+        seconds = elapsed_seconds(&start, &end);
+        if(seconds >= min_seconds) return seconds;
+        *count *= 2;
+    }
+}
+
+void print_json_string(const char *s){
+    fputc('"', out);
+    for(; *s; s++){
+        if(*s == '"' || *s == '\\'){
+            fputc('\\', out);
+            fputc(*s, out);
+        }else if((unsigned char)*s < 0x20){
+            fprintf(out, "\\u%04x", *s);
+        }else{
+            fputc(*s, out);
+        }
+    }
+    fputc('"', out);
+}
+
+void begin_result(const char *kind, const char *name, engines engine){
+    fprintf(out, "%s\n    {\"kind\": \"%s\", \"name\": ", results++ ? "," : "", kind);
+    print_json_string(name);
+    fprintf(out, ", \"engine\": \"%s\"", engine_names[engine]);
+}
+
+void bench_opcode(const opcode_bench *bench, engines engine, chip8 *chip8_object_ptr){
+    __uint8_t program[0x200];
+    size_t len = build_opcode_program(bench, program);
+    long count;
+
+    load_program(chip8_object_ptr, program, len, engine);
+
+    //Untimed warm-up so decoding/translation isn't part of the measurement
+    execute_instructions(chip8_object_ptr, BENCH_BODY * 64);
+
+    double seconds = time_instructions(chip8_object_ptr, &count);
+
+    begin_result("opcode", bench->name, chip8_object_ptr->engine);
+    fprintf(out, ", \"instructions\": %ld, \"seconds\": %.6f, \"mips\": %.3f, \"ns_per_instruction\": %.3f}",
+        count, seconds, count / seconds / 1e6, seconds * 1e9 / count);
+
+    destroy_chip8(chip8_object_ptr);
+}
+
+void bench_rom(const char *name, const __uint8_t *program, size_t len, engines engine, chip8 *chip8_object_ptr){
+    long count, frames;
+
+    load_program(chip8_object_ptr, program, len, engine);
+    execute_instructions(chip8_object_ptr, 1 << 12);
+    double seconds = time_instructions(chip8_object_ptr, &count);
+    destroy_chip8(chip8_object_ptr);
+
+    load_program(chip8_object_ptr, program, len, engine);
+    double frame_seconds = time_frames(chip8_object_ptr, &frames);
+
+    begin_result("rom", name, chip8_object_ptr->engine);
+    fprintf(out, ", \"instructions\": %ld, \"seconds\": %.6f, \"mips\": %.3f"
+                 ", \"frames\": %ld, \"frame_seconds\": %.6f, \"frames_per_second\": %.1f}",
+        count, seconds, count / seconds / 1e6, frames, frame_seconds, frames / frame_seconds);
+
+    destroy_chip8(chip8_object_ptr);
+}
+
+int main(int argc, char **argv){
+    int engine_selected = -1;
+    const char *out_name = NULL;
+    int rom_count = 0;
+    char **rom_names = calloc(argc, sizeof *rom_names);
+
+    for(int i=1; i<argc; i++){
+        if(!strcmp(argv[i], "--engine") && i + 1 < argc){
+            i++;
+            if(!strcmp(argv[i], "interpreter")){
+                engine_selected = ENGINE_INTERPRETER;
+            }else if(!strcmp(argv[i], "block")){
+                engine_selected = ENGINE_BLOCK;
+            }else if(!strcmp(argv[i], "jit")){
+                engine_selected = ENGINE_JIT;
+            }else{
+                usage();
+            }
+        }else if(!strcmp(argv[i], "--time") && i + 1 < argc){
+            min_seconds = strtod(argv[++i], NULL);
+            if(min_seconds <= 0){
+                usage();
+            }
+        }else if(!strcmp(argv[i], "-o") && i + 1 < argc){
+            out_name = argv[++i];
+        }else if(argv[i][0] != '-'){
+            rom_names[rom_count++] = argv[i];
+        }else{
+            usage();
+        }
+    }
+
+    //The core reports problems on stdout, keep them out of the JSON when writing to a file
+    out = stdout;
+    if(out_name){
+        out = fopen(out_name, "w");
+        if(out == NULL){
+            printf("Error creating %s\n", out_name);
+            exit(1);
+        }
+    }
+
+    chip8 *chip8_object_ptr = malloc(sizeof *chip8_object_ptr);
+    if(!chip8_object_ptr){
+        printf("Out of memory\n");
+        exit(1);
+    }
+
+    fprintf(out, "{\n  \"body_length\": %d,\n  \"min_seconds\": %.3f,\n  \"results\": [", BENCH_BODY, min_seconds);
+
+    for(int engine=ENGINE_INTERPRETER; engine<=ENGINE_JIT; engine++){
+        if(engine_selected >= 0 && engine != engine_selected) continue;
+
+        for(size_t i=0; i<sizeof opcode_benches / sizeof opcode_benches[0]; i++){
+            bench_opcode(&opcode_benches[i], engine, chip8_object_ptr);
+        }
+
+        for(size_t i=0; i<sizeof rom_benches / sizeof rom_benches[0]; i++){
+            __uint8_t program[0x200];
+            size_t len = 0;
+
+            for(size_t j=0; j<rom_benches[i].length; j++){
+                len = put_opcode(program, 0x200 + len, rom_benches[i].code[j]) - 0x200;
+            }
+            bench_rom(rom_benches[i].name, program, len, engine, chip8_object_ptr);
+        }
+
+        for(int i=0; i<rom_count; i++){
+            FILE *rom = fopen(rom_names[i], "rb");
+            __uint8_t program[RAM_SIZE - 0x200];
+
+            if(rom == NULL){
+                printf("Error opening ROM %s\n", rom_names[i]);
+                exit(1);
+            }
+            size_t len = fread(program, 1, sizeof program, rom);
+            fclose(rom);
+
+            bench_rom(rom_names[i], program, len, engine, chip8_object_ptr);
+        }
+    }
+
+    fprintf(out, "\n  ]\n}\n");
+
+    if(out != stdout){
+        fclose(out);
+    }
+    free(chip8_object_ptr);
+    free(rom_names);
+
+    return 0;
+}
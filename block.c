@@ -0,0 +1,192 @@
+#include <stdlib.h>
+#include <string.h>
+#include "chip8.h"
+
+/*
+Block engine: straight-line runs of instructions are translated once into
+an array of decoded instructions (a block) and executed back to back without
+going through execute_instruction() for every opcode. A block ends at the
+first instruction that reads or changes PC, or that writes RAM, so only the
+last instruction of a block ever needs an up to date PC.
+*/
+
+typedef struct block{
+    __uint16_t start; //Address of the first instruction
+    __uint8_t length; //Number of instructions in ops
+    instruction ops[BLOCK_MAX_LENGTH]; //Copies of the decoded instructions, executed in order
+} block;
+
+typedef struct block_cache{
+    block *entries[RAM_SIZE]; //Block starting at each address, NULL = not translated yet
+    __uint8_t code_pages[CODE_PAGES]; //Pages some translated block was read from, writes elsewhere are data
+} block_cache;
+
+void initialize_block_engine(chip8 *chip8_object_ptr){
+    if(chip8_object_ptr->blocks) return;
+
+    chip8_object_ptr->blocks = calloc(1, sizeof(block_cache));
+    if(!chip8_object_ptr->blocks){
+        printf("Error allocating block cache\n");
+        exit(1);
+    }
+}
+
+void destroy_block_engine(chip8 *chip8_object_ptr){
+    block_cache *cache = chip8_object_ptr->blocks;
+
+    if(!cache) return;
+
+    for(int i=0; i<RAM_SIZE; i++){
+        free(cache->entries[i]);
+    }
+    free(cache);
+    chip8_object_ptr->blocks = NULL;
+}
+
+//Instructions after which the next PC isn't simply the following address, that write RAM, or that halt the machine
+int block_terminator(handler_fn handler){
+    return handler == set_pc ||
+           handler == call_subroutine ||
+           handler == return_from_subroutine ||
+           handler == jump_with_offset ||
+           handler == skip_constant_equal ||
+           handler == skip_not_constant_equal ||
+           handler == skip_register_equal ||
+           handler == skip_register_not_equal ||
+           handler == skip_if_key ||
+           handler == skip_if_not_key ||
+           handler == get_key ||
+           handler == exit_interpreter ||
+           handler == long_index ||
+           handler == store_memory ||
+           handler == store_memory_increment ||
+           handler == save_range ||
+           handler == decimal_conversion;
+}
+
+static block *translate_block(chip8 *chip8_object_ptr, __uint16_t start){
+    block *new_block = malloc(sizeof(block));
+    if(!new_block){
+        printf("Error allocating block\n");
+        exit(1);
+    }
+
+    new_block->start = start;
+    new_block->length = 0;
+
+    __uint16_t address = start;
+
+    while(new_block->length < BLOCK_MAX_LENGTH){
+        const instruction *ins = &chip8_object_ptr->decoded[address & (RAM_SIZE - 1)];
+
+        if(!ins->handler){
+            ins = decode_instruction(chip8_object_ptr, address);
+        }
+
+        new_block->ops[new_block->length++] = *ins;
+        chip8_object_ptr->blocks->code_pages[(address & (RAM_SIZE - 1)) / CODE_PAGE_SIZE] = 1;
+        chip8_object_ptr->blocks->code_pages[((address + 1) & (RAM_SIZE - 1)) / CODE_PAGE_SIZE] = 1;
+
+        if(block_terminator(ins->handler)) break;
+
+        address += 2;
+    }
+
+    return new_block;
+}
+
+//Drop every block that may overlap a page written since the last check
+static void flush_written_pages(chip8 *chip8_object_ptr){
+    block_cache *cache = chip8_object_ptr->blocks;
+
+    for(int page=chip8_object_ptr->first_written_page; page<=chip8_object_ptr->last_written_page; page++){
+        if(!(chip8_object_ptr->written_pages[page / 8] & (1 << (page % 8)))) continue;
+
+        //Writes to pages no block was translated from can't make anything stale
+        if(!cache->code_pages[page]) continue;
+        cache->code_pages[page] = 0;
+
+        //A block starting up to BLOCK_MAX_LENGTH instructions before the page can reach into it
+        int first = page * CODE_PAGE_SIZE - 2 * BLOCK_MAX_LENGTH + 1;
+        int last = page * CODE_PAGE_SIZE + CODE_PAGE_SIZE - 1;
+
+        for(int address=first; address<=last; address++){
+            block **entry = &cache->entries[address & (RAM_SIZE - 1)];
+            free(*entry);
+            *entry = NULL;
+        }
+    }
+
+    clear_written_pages(chip8_object_ptr);
+}
+
+//Runs the first count instructions of a block, count is at most the block length
+static void run_block(chip8 *chip8_object_ptr, const block *current, long count){
+    const instruction *ins = current->ops;
+
+    //Everything but the block's last instruction leaves PC alone, so it's only updated once
+    long body = (count < current->length) ? count : current->length - 1;
+
+    for(long i=0; i<body; i++, ins++){
+        ins->handler(chip8_object_ptr, ins);
+    }
+
+    chip8_object_ptr->PC = current->start + 2 * body;
+
+    if(count == current->length){
+        chip8_object_ptr->PC+=2;
+        ins->handler(chip8_object_ptr, ins);
+    }
+}
+
+//run_block() with every instruction recorded in the trace first, kept apart so the plain loop stays tight
+static void run_block_traced(chip8 *chip8_object_ptr, const block *current, long count){
+    const instruction *ins = current->ops;
+
+    for(long i=0; i<count; i++, ins++){
+        //Handlers that read PC expect it to point past their instruction
+        chip8_object_ptr->PC = current->start + 2 * i;
+        trace_instruction(chip8_object_ptr->trace, chip8_object_ptr, chip8_object_ptr->PC, ins->opcode);
+        chip8_object_ptr->PC+=2;
+        ins->handler(chip8_object_ptr, ins);
+    }
+}
+
+long execute_blocks(chip8 *chip8_object_ptr, long count){
+    block_cache *cache = chip8_object_ptr->blocks;
+    const long budget = count;
+
+    while(count > 0 && chip8_object_ptr->state == RUNNING){
+        if(chip8_object_ptr->pages_written){
+            flush_written_pages(chip8_object_ptr);
+        }
+
+        if(IDLE_LOOP_CANDIDATE(chip8_object_ptr)){
+            long skipped = skip_idle_loop(chip8_object_ptr, count);
+
+            if(skipped){
+                count -= skipped;
+                continue;
+            }
+        }
+
+        block **entry = &cache->entries[chip8_object_ptr->PC & (RAM_SIZE - 1)];
+
+        if(!*entry){
+            *entry = translate_block(chip8_object_ptr, chip8_object_ptr->PC);
+        }
+
+        long run = ((*entry)->length < count) ? (*entry)->length : count;
+
+        if(chip8_object_ptr->trace){
+            run_block_traced(chip8_object_ptr, *entry, run);
+        }else{
+            run_block(chip8_object_ptr, *entry, run);
+        }
+        if(chip8_object_ptr->profile){
+            profile_block(chip8_object_ptr->profile, (*entry)->ops, (*entry)->start, run);
+        }
+        count -= run;
+    }
+    return budget - count;
+}
@@ -0,0 +1,418 @@
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "chip8.h"
+
+/*
+Frame capture. Once per emulated frame capture_frame() copies the display
+bitplanes (2 KB) into a slot of a bounded queue and returns; a writer
+thread takes the slots in order and encodes them, so encoding and disk
+writes never run on the emulation thread. When the writer falls behind
+and the queue is full the policy decides: CAPTURE_BLOCK waits for a free
+slot (every frame is kept, emulation slows down to the writer's pace),
+CAPTURE_DROP discards the new frame and counts it.
+
+Every frame is DISPLAY_WIDTH x DISPLAY_HEIGHT times the scale, low
+resolution frames are doubled, so a file keeps one size when a ROM
+switches modes. Pixels take the colour of their value 0-3 from the palette.
+  raw: RGB24 frames back to back, no header
+  y4m: YUV4MPEG2 4:4:4 at 60 fps, BT.601 studio range
+  png: one file per frame, path is a printf pattern such as shot%05d.png;
+       8-bit indexed PNGs with stored (uncompressed) deflate blocks, so no
+       zlib is needed
+*/
+
+//Frames in flight between the emulation thread and the writer
+#define CAPTURE_QUEUE_FRAMES 32
+
+//Largest deflate stored block
+#define STORED_BLOCK_SIZE 65535
+
+typedef struct{
+    __uint64_t display[DISPLAY_PLANES][DISPLAY_HEIGHT][DISPLAY_WORDS];
+    __uint8_t hires;
+} capture_slot;
+
+struct capture{
+    capture_formats format;
+    capture_policies policy;
+    int scale;
+    int width, height; //Output frame size
+    __uint32_t palette[4]; //ARGB8888 by pixel value
+    const char *path;
+    char pattern[4096]; //PNG file names, path with the frame number conversion normalised
+    FILE *file; //Raw and Y4M output, PNGs open one file per frame
+
+    capture_slot slots[CAPTURE_QUEUE_FRAMES];
+    __uint64_t head; //Frames queued, guarded by lock
+    __uint64_t tail; //Frames encoded, guarded by lock
+    int stopping; //No more frames will be queued
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+    pthread_t writer;
+
+    __uint64_t dropped; //Frames discarded by CAPTURE_DROP, emulation thread only
+    __uint8_t *pixels; //Writer: one frame of pixel values
+    __uint8_t *scratch; //Writer: encoded frame
+    __uint32_t crc_table[256];
+};
+
+static void write_bytes(capture *capture_ptr, FILE *file, const void *data, size_t size){
+    if(fwrite(data, 1, size, file) != size){
+        printf("Error writing capture %s\n", capture_ptr->path);
+        exit(1);
+    }
+}
+
+//Pixel values of a queued frame, at the output size
+static void expand_frame(capture *capture_ptr, const capture_slot *slot){
+    int factor = capture_ptr->scale * (slot->hires ? 1 : DISPLAY_WIDTH / LORES_WIDTH);
+    int source_width = capture_ptr->width / factor;
+    int source_height = capture_ptr->height / factor;
+
+    for(int y=0; y<source_height; y++){
+        __uint8_t *row = capture_ptr->pixels + (size_t)y * factor * capture_ptr->width;
+
+        for(int x=0; x<source_width; x++){
+            __uint8_t value = ((slot->display[0][y][x >> 6] >> (63 - (x & 63))) & 1)
+                            | (((slot->display[1][y][x >> 6] >> (63 - (x & 63))) & 1) << 1);
+            memset(row + x * factor, value, factor);
+        }
+        for(int i=1; i<factor; i++){
+            memcpy(row + (size_t)i * capture_ptr->width, row, capture_ptr->width);
+        }
+    }
+}
+
+static void write_raw(capture *capture_ptr){
+    size_t count = (size_t)capture_ptr->width * capture_ptr->height;
+
+    for(size_t i=0; i<count; i++){
+        __uint32_t color = capture_ptr->palette[capture_ptr->pixels[i]];
+
+        capture_ptr->scratch[3 * i] = color >> 16;
+        capture_ptr->scratch[3 * i + 1] = color >> 8;
+        capture_ptr->scratch[3 * i + 2] = color;
+    }
+    write_bytes(capture_ptr, capture_ptr->file, capture_ptr->scratch, 3 * count);
+}
+
+static void write_y4m(capture *capture_ptr){
+    size_t count = (size_t)capture_ptr->width * capture_ptr->height;
+    __uint8_t planes[3][4];
+
+    //The palette has four colours, convert those rather than every pixel
+    for(int i=0; i<4; i++){
+        double r = (capture_ptr->palette[i] >> 16) & 0xff;
+        double g = (capture_ptr->palette[i] >> 8) & 0xff;
+        double b = capture_ptr->palette[i] & 0xff;
+
+        planes[0][i] = (__uint8_t)(16.5 + 0.257 * r + 0.504 * g + 0.098 * b);
+        planes[1][i] = (__uint8_t)(128.5 - 0.148 * r - 0.291 * g + 0.439 * b);
+        planes[2][i] = (__uint8_t)(128.5 + 0.439 * r - 0.368 * g - 0.071 * b);
+    }
+
+    for(int plane=0; plane<3; plane++){
+        for(size_t i=0; i<count; i++){
+            capture_ptr->scratch[plane * count + i] = planes[plane][capture_ptr->pixels[i]];
+        }
+    }
+
+    write_bytes(capture_ptr, capture_ptr->file, "FRAME\n", 6);
+    write_bytes(capture_ptr, capture_ptr->file, capture_ptr->scratch, 3 * count);
+}
+
+static __uint32_t crc32_update(const capture *capture_ptr, __uint32_t crc, const __uint8_t *data, size_t size){
+    for(size_t i=0; i<size; i++){
+        crc = capture_ptr->crc_table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    }
+    return crc;
+}
+
+static void put32(__uint8_t *out, __uint32_t value){
+    out[0] = value >> 24;
+    out[1] = value >> 16;
+    out[2] = value >> 8;
+    out[3] = value;
+}
+
+//Length, type, data, CRC of type and data
+static void write_chunk(capture *capture_ptr, FILE *file, const char *type, const __uint8_t *data, size_t size){
+    __uint8_t word[4];
+    __uint32_t crc = crc32_update(capture_ptr, 0xFFFFFFFF, (const __uint8_t *)type, 4);
+
+    crc = crc32_update(capture_ptr, crc, data, size) ^ 0xFFFFFFFF;
+
+    put32(word, size);
+    write_bytes(capture_ptr, file, word, 4);
+    write_bytes(capture_ptr, file, type, 4);
+    write_bytes(capture_ptr, file, data, size);
+    put32(word, crc);
+    write_bytes(capture_ptr, file, word, 4);
+}
+
+static void write_png(capture *capture_ptr, __uint64_t number){
+    static const __uint8_t signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+    char name[4096];
+    __uint8_t header[13];
+    __uint8_t palette[12];
+
+    snprintf(name, sizeof name, capture_ptr->pattern, (unsigned long long)number);
+    FILE *file = fopen(name, "wb");
+    if(file == NULL){
+        printf("Error creating %s\n", name);
+        exit(1);
+    }
+
+    //8-bit indexed colour, deflate, adaptive filtering (each row says None), no interlace
+    put32(header, capture_ptr->width);
+    put32(header + 4, capture_ptr->height);
+    header[8] = 8;
+    header[9] = 3;
+    header[10] = 0;
+    header[11] = 0;
+    header[12] = 0;
+
+    for(int i=0; i<4; i++){
+        palette[3 * i] = capture_ptr->palette[i] >> 16;
+        palette[3 * i + 1] = capture_ptr->palette[i] >> 8;
+        palette[3 * i + 2] = capture_ptr->palette[i];
+    }
+
+    //zlib stream of stored blocks over the filtered rows, each row is a 0 filter byte and its pixels
+    size_t raw_size = (size_t)capture_ptr->height * (capture_ptr->width + 1);
+    __uint8_t *out = capture_ptr->scratch;
+    size_t length = 0;
+    __uint32_t adler_a = 1, adler_b = 0;
+    size_t raw_position = 0;
+
+    out[length++] = 0x78;
+    out[length++] = 0x01;
+
+    while(raw_position < raw_size){
+        size_t block = raw_size - raw_position;
+        if(block > STORED_BLOCK_SIZE) block = STORED_BLOCK_SIZE;
+
+        out[length++] = (raw_position + block == raw_size); //BFINAL, BTYPE 00
+        out[length++] = block & 0xff;
+        out[length++] = block >> 8;
+        out[length++] = ~block & 0xff;
+        out[length++] = (~block >> 8) & 0xff;
+
+        for(size_t i=0; i<block; i++, raw_position++){
+            size_t column = raw_position % (capture_ptr->width + 1);
+            size_t row = raw_position / (capture_ptr->width + 1);
+            __uint8_t byte = column ? capture_ptr->pixels[row * capture_ptr->width + column - 1] : 0;
+
+            out[length++] = byte;
+            adler_a = (adler_a + byte) % 65521;
+            adler_b = (adler_b + adler_a) % 65521;
+        }
+    }
+    put32(out + length, (adler_b << 16) | adler_a);
+    length += 4;
+
+    write_bytes(capture_ptr, file, signature, sizeof signature);
+    write_chunk(capture_ptr, file, "IHDR", header, sizeof header);
+    write_chunk(capture_ptr, file, "PLTE", palette, sizeof palette);
+    write_chunk(capture_ptr, file, "IDAT", out, length);
+    write_chunk(capture_ptr, file, "IEND", NULL, 0);
+
+    if(fclose(file) != 0){
+        printf("Error writing %s\n", name);
+        exit(1);
+    }
+}
+
+static void *writer_main(void *arg){
+    capture *capture_ptr = arg;
+
+    for(;;){
+        pthread_mutex_lock(&capture_ptr->lock);
+        while(capture_ptr->head == capture_ptr->tail && !capture_ptr->stopping){
+            pthread_cond_wait(&capture_ptr->not_empty, &capture_ptr->lock);
+        }
+        if(capture_ptr->head == capture_ptr->tail){
+            pthread_mutex_unlock(&capture_ptr->lock);
+            break;
+        }
+        __uint64_t number = capture_ptr->tail;
+        pthread_mutex_unlock(&capture_ptr->lock);
+
+        //The slot stays ours until tail moves past it
+        expand_frame(capture_ptr, &capture_ptr->slots[number % CAPTURE_QUEUE_FRAMES]);
+
+        switch(capture_ptr->format){
+            case CAPTURE_RAW:
+                write_raw(capture_ptr);
+                break;
+            case CAPTURE_Y4M:
+                write_y4m(capture_ptr);
+                break;
+            case CAPTURE_PNG:
+                write_png(capture_ptr, number);
+                break;
+        }
+
+        pthread_mutex_lock(&capture_ptr->lock);
+        capture_ptr->tail++;
+        pthread_cond_signal(&capture_ptr->not_full);
+        pthread_mutex_unlock(&capture_ptr->lock);
+    }
+    return NULL;
+}
+
+/*
+A PNG path has exactly one integer conversion for the frame number (%d,
+%05u, %llu...), nothing else a printf would read. It's rewritten to take
+the unsigned long long the writer passes. Returns 0 if the path isn't
+such a pattern.
+*/
+static int png_pattern(const char *path, char *pattern, size_t size){
+    int conversions = 0;
+    size_t length = 0;
+
+    for(const char *c=path; *c; c++){
+        if(length + 4 >= size) return 0;
+        pattern[length++] = *c;
+
+        if(*c != '%') continue;
+        if(c[1] == '%'){
+            pattern[length++] = *++c;
+            continue;
+        }
+
+        while(c[1] >= '0' && c[1] <= '9'){
+            if(length + 4 >= size) return 0;
+            pattern[length++] = *++c;
+        }
+        if(c[1] == 'l') c++;
+        if(c[1] == 'l') c++;
+        if(c[1] != 'd' && c[1] != 'u') return 0;
+        c++;
+        memcpy(pattern + length, "llu", 3);
+        length += 3;
+        conversions++;
+    }
+    pattern[length] = '\0';
+    return conversions == 1;
+}
+
+capture *start_capture(const char *path, capture_formats format, int scale, capture_policies policy, const __uint32_t palette[4]){
+    capture *capture_ptr = calloc(1, sizeof(capture));
+
+    if(!capture_ptr){
+        printf("Error allocating capture\n");
+        exit(1);
+    }
+
+    capture_ptr->format = format;
+    capture_ptr->policy = policy;
+    capture_ptr->scale = scale;
+    capture_ptr->width = DISPLAY_WIDTH * scale;
+    capture_ptr->height = DISPLAY_HEIGHT * scale;
+    capture_ptr->path = path;
+    memcpy(capture_ptr->palette, palette, sizeof capture_ptr->palette);
+
+    for(__uint32_t i=0; i<256; i++){
+        __uint32_t crc = i;
+        for(int bit=0; bit<8; bit++){
+            crc = (crc & 1) ? 0xEDB88320 ^ (crc >> 1) : crc >> 1;
+        }
+        capture_ptr->crc_table[i] = crc;
+    }
+
+    //Worst case is a PNG: the zlib stream, with a 5-byte header per stored block
+    size_t count = (size_t)capture_ptr->width * capture_ptr->height;
+    size_t raw_size = (size_t)capture_ptr->height * (capture_ptr->width + 1);
+    size_t scratch_size = 3 * count;
+    size_t png_size = raw_size + 5 * (raw_size / STORED_BLOCK_SIZE + 1) + 6;
+    if(png_size > scratch_size) scratch_size = png_size;
+
+    capture_ptr->pixels = malloc(count);
+    capture_ptr->scratch = malloc(scratch_size);
+    if(!capture_ptr->pixels || !capture_ptr->scratch){
+        printf("Error allocating capture\n");
+        exit(1);
+    }
+
+    if(format == CAPTURE_PNG){
+        if(!png_pattern(path, capture_ptr->pattern, sizeof capture_ptr->pattern)){
+            printf("PNG capture path needs one frame number, e.g. shot%%05d.png: %s\n", path);
+            exit(1);
+        }
+    }else{
+        capture_ptr->file = fopen(path, "wb");
+        if(capture_ptr->file == NULL){
+            printf("Error creating capture %s\n", path);
+            exit(1);
+        }
+        if(format == CAPTURE_Y4M){
+            fprintf(capture_ptr->file, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C444\n",
+                capture_ptr->width, capture_ptr->height, TIMER_HZ);
+        }
+    }
+
+    pthread_mutex_init(&capture_ptr->lock, NULL);
+    pthread_cond_init(&capture_ptr->not_empty, NULL);
+    pthread_cond_init(&capture_ptr->not_full, NULL);
+    if(pthread_create(&capture_ptr->writer, NULL, writer_main, capture_ptr) != 0){
+        printf("Error creating capture thread\n");
+        exit(1);
+    }
+
+    return capture_ptr;
+}
+
+void capture_frame(capture *capture_ptr, const chip8 *chip8_object_ptr){
+    pthread_mutex_lock(&capture_ptr->lock);
+    while(capture_ptr->head - capture_ptr->tail == CAPTURE_QUEUE_FRAMES){
+        if(capture_ptr->policy == CAPTURE_DROP){
+            pthread_mutex_unlock(&capture_ptr->lock);
+            capture_ptr->dropped++;
+            return;
+        }
+        pthread_cond_wait(&capture_ptr->not_full, &capture_ptr->lock);
+    }
+    __uint64_t number = capture_ptr->head;
+    pthread_mutex_unlock(&capture_ptr->lock);
+
+    //The writer doesn't look at the slot until head moves past it
+    capture_slot *slot = &capture_ptr->slots[number % CAPTURE_QUEUE_FRAMES];
+    memcpy(slot->display, chip8_object_ptr->display, sizeof slot->display);
+    slot->hires = chip8_object_ptr->hires;
+
+    pthread_mutex_lock(&capture_ptr->lock);
+    capture_ptr->head++;
+    pthread_cond_signal(&capture_ptr->not_empty);
+    pthread_mutex_unlock(&capture_ptr->lock);
+}
+
+//Waits for the writer to finish the frames already queued
+void stop_capture(capture *capture_ptr){
+    pthread_mutex_lock(&capture_ptr->lock);
+    capture_ptr->stopping = 1;
+    pthread_cond_signal(&capture_ptr->not_empty);
+    pthread_mutex_unlock(&capture_ptr->lock);
+
+    pthread_join(capture_ptr->writer, NULL);
+
+    if(capture_ptr->file && fclose(capture_ptr->file) != 0){
+        printf("Error writing capture %s\n", capture_ptr->path);
+        exit(1);
+    }
+
+    printf("Captured %llu frames to %s, dropped %llu\n", (unsigned long long)capture_ptr->tail,
+        capture_ptr->path, (unsigned long long)capture_ptr->dropped);
+
+    pthread_mutex_destroy(&capture_ptr->lock);
+    pthread_cond_destroy(&capture_ptr->not_empty);
+    pthread_cond_destroy(&capture_ptr->not_full);
+    free(capture_ptr->pixels);
+    free(capture_ptr->scratch);
+    free(capture_ptr);
+}
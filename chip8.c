@@ -1,115 +1,235 @@
+#define _POSIX_C_SOURCE 199309L
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <math.h>
 #include <SDL2/SDL.h>
 #include <SDL2/SDL_audio.h>
 #include <SDL2/SDL_timer.h>
 #include <unistd.h>
 #include <time.h>
+#include <signal.h>
+#include "chip8.h"
+
+//Colours and filtering used by draw()
+typedef struct{
+    __uint32_t fg_color; //Colour of lit pixels, ARGB8888
+    __uint32_t bg_color; //Colour of unlit pixels, ARGB8888
+    __uint32_t plane2_color; //Pixels lit only in the second XO-CHIP plane
+    __uint32_t both_color; //Pixels lit in both planes
+    const char *scale_quality; //"nearest" or "linear" filtering when the texture is scaled to the window
+} video_options;
+
+//Pacing of the windowed main loop
+typedef struct{
+    long ips; //Instructions per second of machine time
+    double speed; //Machine seconds per wall-clock second, above 1 fast-forwards
+    int turbo; //Emulate as fast as the host allows, only drawing at the display refresh rate
+    int input_polls; //Times the keypad is read per emulated frame, spread over its instructions
+} scheduler_options;
+
+//Longest sleep while parked in Fx0A, so a SIGUSR1 profile request is still seen
+#define PARK_TIMEOUT_MS 250
 
-#define first_nible (ins & 0xf000) >> 12
-#define second_nible (ins & 0x0f00) >> 8
-#define third_nible (ins & 0x00f0) >> 4
-#define fourth_nible (ins & 0x000f)
+//Same while exporting, commands from another process don't wake SDL up
+#define EXPORT_PARK_TIMEOUT_MS 16
 
-typedef enum{
-    RUNNING,
-    NOT_RUNNING
-} states;
+//Set by SIGUSR1, the main loops print the profile when they see it
+static volatile sig_atomic_t profile_requested = 0;
+
+void request_profile(int signal_number){
+    (void)signal_number;
+    profile_requested = 1;
+}
+
+void check_profile_request(chip8 *chip8_object_ptr){
+    if(profile_requested){
+        profile_requested = 0;
+        print_profile(stderr, chip8_object_ptr);
+    }
+}
 
+//Beep settings, see open_audio()
 typedef struct{
-    __uint8_t RAM[4096]; //Stores data regarding the program
-    __uint8_t display[64 * 32]; //Stores the value of pixels that will be displayed
-    __uint16_t PC; //Points at current instruction in memory(RAM)
-    __uint16_t I; //Points at locations in memory(RAM)
-    __uint16_t stack[24]; //Stores 16-bit addresses which is used to call subroutines/functions and return from them  
-    __uint8_t sp; //Stores the index value which pointes to the top  of the stack 
-    __uint8_t registers[16]; //General-purpose variable registers 
-    __uint8_t delay_timer; //Delay timer which is decremented at a rate of 60 Hz until it reaches 0
-    __uint8_t sound_timer; //Sound timer which functions like the delay timer, but which also gives off a beeping sound as long as it’s not 0
-    __uint8_t keys[16]; //Checks if a key is pressed by turning the coresponding index in keys to true
-    states state; //The state of the emulator Running/Not-Running
-} chip8;
-
-
-
-void initialize_chip8(chip8 *chip8_object_ptr, FILE *rom){
-    
-    //The font represents the hexidacimal number 0-F
-    char fonts[] = {
-        0xF0, 0x90, 0x90, 0x90, 0xF0, // 0 
-        0x20, 0x60, 0x20, 0x20, 0x70, // 1
-        0xF0, 0x10, 0xF0, 0x80, 0xF0, // 2
-        0xF0, 0x10, 0xF0, 0x10, 0xF0, // 3
-        0x90, 0x90, 0xF0, 0x10, 0x10, // 4
-        0xF0, 0x80, 0xF0, 0x10, 0xF0, // 5
-        0xF0, 0x80, 0xF0, 0x90, 0xF0, // 6
-        0xF0, 0x10, 0x20, 0x40, 0x40, // 7
-        0xF0, 0x90, 0xF0, 0x90, 0xF0, // 8
-        0xF0, 0x90, 0xF0, 0x10, 0xF0, // 9
-        0xF0, 0x90, 0xF0, 0x90, 0x90, // A
-        0xE0, 0x90, 0xE0, 0x90, 0xE0, // B
-        0xF0, 0x80, 0x80, 0x80, 0xF0, // C
-        0xE0, 0x90, 0x90, 0x90, 0xE0, // D
-        0xF0, 0x80, 0xF0, 0x80, 0xF0, // E
-        0xF0, 0x80, 0xF0, 0x80, 0x80  // F
-    };
+    int frequency; //Tone in Hz
+    int volume; //Percent of full scale
+    int buffer_samples; //Samples per callback, the latency floor
+} audio_options;
 
-    //Load fonts into chip8 memory
-    memcpy(chip8_object_ptr->RAM, fonts, sizeof(fonts));  
+//Beeper edges in flight, a power of two
+#define AUDIO_EDGES 256
+//Samples in one period of the wavetable, a power of two indexed by the top bits of the phase
+#define WAVETABLE_SIZE 256
 
-        //Get size of ROM in bytes
-    fseek(rom, 0, SEEK_END);
-    long size = ftell(rom);
-    rewind(rom);
+//The beeper changing at an emulated time: turning on or off, or a new XO-CHIP pattern or pitch
+typedef struct{
+    __uint64_t time; //Samples of emulated time since the device was opened
+    __uint8_t on;
+    __uint8_t use_pattern; //Play pattern instead of the wavetable
+    __uint8_t pattern[AUDIO_PATTERN_SIZE];
+    __uint32_t pattern_step; //Phase increment per sample for the pattern, 128 bits is 2^32
+} audio_edge;
+
+/*
+Beeper. The emulation thread never touches the device: once per emulated
+frame audio_frame() advances an emulated clock, counted in output samples,
+and when the beeper changed it queues the edge with the time of the frame it
+happened in. The queue is single producer/single consumer; each side only
+stores its own index, with release semantics, so neither ever waits. The
+callback plays emulated time a fixed latency behind the last published
+clock, applying each edge on the exact sample it falls on, and reads one
+period of the tone from a wavetable with a fixed-point phase, no division
+per sample. An XO-CHIP pattern is played the same way, the top 7 bits of
+the phase picking one of its 128 bits; loading a pattern or changing the
+pitch is an edge too. When the two clocks drift too far apart (a stall, fast-forward,
+turbo) the callback jumps to the current time and applies the edges it
+skipped in order, so the beeper always ends up in the state the machine is
+in.
+*/
+typedef struct{
+    SDL_AudioDeviceID device;
+    int sample_rate;
+    __uint64_t latency; //How far playback runs behind the emulated clock, in samples
+    __int16_t wavetable[WAVETABLE_SIZE];
+    __uint32_t phase_step; //Phase increment per sample, one period is 2^32
+    __int16_t amplitude;
+
+    //Emulation thread
+    audio_edge edges[AUDIO_EDGES];
+    __uint32_t edge_head; //Edges queued, published with a release store
+    __uint64_t frames; //Frames seen by audio_frame()
+    __uint64_t clock; //Emulated time at the end of the last frame, published with a release store
+    audio_edge queued; //The last edge queued, time aside
+
+    //Audio callback
+    __uint32_t edge_tail; //Edges consumed, published with a release store
+    __uint64_t position; //Emulated time of the next sample rendered
+    __uint32_t phase;
+    audio_edge current; //The last edge applied
+} audio_output;
 
-    //Where the ROM should be loaded at RAM
-    __uint16_t start = 0x200;
-    
-    //Load ROM data into chip8 memory
-    fread(chip8_object_ptr->RAM + 0x200, size, 1, rom);
-    
-    //Set program counter to the start of the program
-    chip8_object_ptr->PC = start;
+void audio_callback(void *userdata, __uint8_t *stream, int len){
+    audio_output *audio = userdata;
+    __int16_t *samples = (__int16_t *)stream;
+    __uint64_t clock = __atomic_load_n(&audio->clock, __ATOMIC_ACQUIRE);
+    __uint32_t head = __atomic_load_n(&audio->edge_head, __ATOMIC_ACQUIRE);
+    __uint32_t tail = audio->edge_tail;
+
+    //Too close to the emulated clock (or past it) to have every edge in time, or too far behind it: resynchronise
+    if(audio->position + audio->latency / 2 > clock || clock - audio->position > 2 * audio->latency){
+        audio->position = (clock > audio->latency) ? clock - audio->latency : 0;
+    }
 
-    //There is no stack yet
-    chip8_object_ptr->sp = -1;
+    __uint64_t next_edge = (tail != head) ? audio->edges[tail & (AUDIO_EDGES - 1)].time : UINT64_MAX;
 
-    //Set the state of the emulator to RUNNING
-    chip8_object_ptr->state = RUNNING;
+    //len is in bytes, the samples are 16-bit mono
+    for(int i = 0; i < len / 2; i++){
+        while(audio->position >= next_edge){
+            const audio_edge *edge = &audio->edges[tail & (AUDIO_EDGES - 1)];
 
-    //Clear diplay 0 = black
-    for(__uint16_t i=0; i < sizeof chip8_object_ptr->display; i++){
-        chip8_object_ptr->display[i] = 0;
+            //Only a beep starting restarts the waveform, a pitch change mid-beep keeps its phase
+            if(edge->on != audio->current.on) audio->phase = 0;
+            audio->current = *edge;
+            tail++;
+            next_edge = (tail != head) ? audio->edges[tail & (AUDIO_EDGES - 1)].time : UINT64_MAX;
+        }
+
+        if(audio->current.on && audio->current.use_pattern){
+            __uint32_t bit = audio->phase >> 25;
+
+            samples[i] = ((audio->current.pattern[bit >> 3] >> (7 - (bit & 7))) & 1) ? audio->amplitude : -audio->amplitude;
+            audio->phase += audio->current.pattern_step;
+        }else if(audio->current.on){
+            samples[i] = audio->wavetable[audio->phase >> 24];
+            audio->phase += audio->phase_step;
+        }else{
+            samples[i] = 0;
+        }
+        audio->position++;
     }
-    
-    //Set keys array elements to 0
-    //0 = No key presses 
-    for(__uint8_t i = 0; i<16; i++){
-        chip8_object_ptr->keys[i] = 0;
+
+    __atomic_store_n(&audio->edge_tail, tail, __ATOMIC_RELEASE);
+}
+
+//Called once per emulated frame, after it ran: beeping says whether the sound timer ran during it
+void audio_frame(audio_output *audio, const chip8 *chip8_object_ptr){
+    __uint64_t frame_start = audio->frames * audio->sample_rate / TIMER_HZ;
+    audio_edge next;
+
+    //Zeroed padding included, edges are compared as bytes
+    memset(&next, 0, sizeof next);
+    next.on = chip8_object_ptr->beeping;
+    next.use_pattern = chip8_object_ptr->audio_pattern_loaded;
+
+    if(next.use_pattern){
+        //4000 bits per second at pitch 64, an octave every 48 steps
+        double rate = 4000.0 * exp2((chip8_object_ptr->pitch - DEFAULT_PITCH) / 48.0);
+
+        memcpy(next.pattern, chip8_object_ptr->audio_pattern, sizeof next.pattern);
+        next.pattern_step = (__uint32_t)(rate * 33554432.0 / audio->sample_rate);
+    }
+
+    if(memcmp(&next, &audio->queued, sizeof next)){
+        __uint32_t tail = __atomic_load_n(&audio->edge_tail, __ATOMIC_ACQUIRE);
+
+        //With the queue full the edge is retried next frame, so on and off still alternate
+        if(audio->edge_head - tail < AUDIO_EDGES){
+            audio_edge *edge = &audio->edges[audio->edge_head & (AUDIO_EDGES - 1)];
+
+            *edge = next;
+            edge->time = frame_start;
+            __atomic_store_n(&audio->edge_head, audio->edge_head + 1, __ATOMIC_RELEASE);
+            audio->queued = next;
+        }
+    }
+
+    audio->frames++;
+    __atomic_store_n(&audio->clock, audio->frames * audio->sample_rate / TIMER_HZ, __ATOMIC_RELEASE);
+}
+
+void open_audio(audio_output *audio, const audio_options *options){
+    SDL_AudioSpec want, have;
+
+    memset(audio, 0, sizeof *audio);
+
+    want = (SDL_AudioSpec){
+        .freq = 44100,
+        .format = AUDIO_S16SYS,
+        .channels = 1,
+        .samples = options->buffer_samples,
+        .callback = audio_callback,
+        .userdata = audio,
+    };
+
+    //The callback writes 16-bit mono whatever the hardware wants, SDL converts
+    audio->device = SDL_OpenAudioDevice(NULL, 0, &want, &have, SDL_AUDIO_ALLOW_FREQUENCY_CHANGE);
+    if(audio->device == 0){
+        fprintf(stderr, "Unable to open audio: %s\n", SDL_GetError());
+        exit(1);
     }
+
+    audio->sample_rate = have.freq;
+    //One callback's worth plus two frames, the emulated clock only moves a frame at a time
+    audio->latency = have.samples + 2 * (__uint64_t)have.freq / TIMER_HZ;
+    audio->phase_step = (__uint32_t)((double)options->frequency * 4294967296.0 / have.freq);
+
+    //A square wave, the tone the beeper always had
+    __int16_t amplitude = (__int16_t)(32767 * options->volume / 100);
+    audio->amplitude = amplitude;
+    for(int i = 0; i < WAVETABLE_SIZE; i++){
+        audio->wavetable[i] = (i < WAVETABLE_SIZE / 2) ? amplitude : -amplitude;
+    }
+
+    //Runs for the whole session, silence is rendered by the callback
+    SDL_PauseAudioDevice(audio->device, 0);
 }
 
-void audio_callback(void *userdata, __uint8_t *stream, int len){
-    userdata = 0;
-
-    int16_t *audio_data = (int16_t *)stream;
-    static uint32_t running_sample_index = 0;
-    const int32_t square_wave_period = 44100 / 440;
-    const int32_t half_square_wave_period = square_wave_period / 2;
-
-    // We are filling out 2 bytes at a time (int16_t), len is in bytes,
-    //   so divide by 2
-    // If the current chunk of audio for the square wave is the crest of the wave, 
-    //   this will add the volume, otherwise it is the trough of the wave, and will add
-    //   "negative" volume
-    for (int i = 0; i < len / 2; i++)
-        audio_data[i] = ((running_sample_index++ / half_square_wave_period) % 2) ? 
-                        3000 : 
-                        -3000;
+void close_audio(audio_output *audio){
+    SDL_CloseAudioDevice(audio->device);
 }
 
-void initialize_sdl(SDL_Window **screen, SDL_Renderer **renderer, SDL_AudioDeviceID *dev, SDL_AudioSpec *want, SDL_AudioSpec *have){
+void initialize_sdl(SDL_Window **screen, SDL_Renderer **renderer, SDL_Texture **texture, const video_options *options){
     // returns zero on success else non-zero
     if (SDL_Init(SDL_INIT_EVERYTHING) != 0) {
         printf("error initializing SDL: %s\n", SDL_GetError());
@@ -131,145 +251,147 @@ void initialize_sdl(SDL_Window **screen, SDL_Renderer **renderer, SDL_AudioDevic
         exit(1);
     }    
 
+    //Keep the 2:1 aspect ratio when the window is resized, the rest is letterboxed; both resolutions are 2:1
+    SDL_RenderSetLogicalSize(*renderer, DISPLAY_WIDTH, DISPLAY_HEIGHT);
+    SDL_SetRenderDrawColor(*renderer, 0, 0, 0, 255);
 
-    want->freq = 44100;
-    want->format = AUDIO_S16LSB;
-    want->channels = 1;
-    want->samples = 512;        /* A good value for games */
-    want->callback = audio_callback;
-
-    *dev = SDL_OpenAudioDevice(NULL, 0, want, have, 0);
+    //Must be set before the texture is created
+    SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, options->scale_quality);
 
-    /* Open the audio device and start playing sound! */
-    if (SDL_OpenAudio(want, NULL) < 0) {
-        fprintf(stderr, "Unable to open audio: %s\n", SDL_GetError());
+    *texture = SDL_CreateTexture(*renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING,
+                                 DISPLAY_WIDTH, DISPLAY_HEIGHT);
+    if(!(*texture)){
+        printf("Error creating texture: %s\n", SDL_GetError());
         exit(1);
     }
+
 }
 
-void destroy_sdl(SDL_Window *screen, SDL_AudioDeviceID *dev){
-    SDL_CloseAudioDevice(*dev);
+void destroy_sdl(SDL_Window *screen, SDL_Renderer *renderer, SDL_Texture *texture){
+    SDL_DestroyTexture(texture);
+    SDL_DestroyRenderer(renderer);
     SDL_DestroyWindow(screen);
     SDL_Quit();
 }
 
-void user_input(chip8 *chip8_object_ptr){
+//Emulator controls user_input() reads besides the keypad
+typedef struct{
+    int rewind; //Backspace is held
+    int save_state; //F5 was pressed since the main loop last looked
+    int load_state; //F9 was pressed since the main loop last looked
+} hotkeys;
+
+//Keypad key for every physical key, by SDL scancode so the layout doesn't move with the keyboard language
+typedef struct{
+    __int8_t keys[SDL_NUM_SCANCODES]; //Key 0-F, -1 for keys the keypad ignores
+} keymap;
+
+//1234/QWER/ASDF/ZXCV stand in for the COSMAC VIP's 123C/456D/789E/A0BF
+void default_keymap(keymap *map){
+    static const struct{
+        SDL_Scancode scancode;
+        __int8_t key;
+    } layout[16] = {
+        {SDL_SCANCODE_1, 0x1}, {SDL_SCANCODE_2, 0x2}, {SDL_SCANCODE_3, 0x3}, {SDL_SCANCODE_4, 0xC},
+        {SDL_SCANCODE_Q, 0x4}, {SDL_SCANCODE_W, 0x5}, {SDL_SCANCODE_E, 0x6}, {SDL_SCANCODE_R, 0xD},
+        {SDL_SCANCODE_A, 0x7}, {SDL_SCANCODE_S, 0x8}, {SDL_SCANCODE_D, 0x9}, {SDL_SCANCODE_F, 0xE},
+        {SDL_SCANCODE_Z, 0xA}, {SDL_SCANCODE_X, 0x0}, {SDL_SCANCODE_C, 0xB}, {SDL_SCANCODE_V, 0xF},
+    };
+
+    memset(map->keys, -1, sizeof map->keys);
+    for(int i=0; i<16; i++){
+        map->keys[layout[i].scancode] = layout[i].key;
+    }
+}
+
+/*
+Keymap file: one mapping per line, a keypad key in hex then the SDL name of
+the physical key ("Keypad 7", "Left Shift", "Q"). A key can be bound to
+several physical keys. Blank lines and lines starting with # are skipped.
+Keys the file doesn't mention are unmapped, the default layout is dropped.
+*/
+void load_keymap(keymap *map, const char *path){
+    char line[256];
+    int line_number = 0;
+    FILE *file = fopen(path, "r");
+
+    if(file == NULL){
+        printf("Error opening keymap %s\n", path);
+        exit(1);
+    }
+
+    memset(map->keys, -1, sizeof map->keys);
+
+    while(fgets(line, sizeof line, file)){
+        char *name;
+        line_number++;
+
+        //Trailing newline and spaces aren't part of the name
+        size_t len = strcspn(line, "\r\n");
+        while(len && line[len - 1] == ' ') len--;
+        line[len] = '\0';
+
+        name = line + strspn(line, " \t");
+        if(*name == '\0' || *name == '#') continue;
+
+        char *end;
+        long key = strtol(name, &end, 16);
+        if(end == name || (*end != ' ' && *end != '\t') || key < 0 || key > 0xF){
+            printf("%s:%d: expected a keypad key 0-F\n", path, line_number);
+            exit(1);
+        }
+
+        name = end + strspn(end, " \t");
+        SDL_Scancode scancode = SDL_GetScancodeFromName(name);
+        if(scancode == SDL_SCANCODE_UNKNOWN){
+            printf("%s:%d: unknown key \"%s\"\n", path, line_number, name);
+            exit(1);
+        }
+        map->keys[scancode] = (__int8_t)key;
+    }
+
+    fclose(file);
+}
+
+//Keyboard events only reach the keypad when live_keys is set, a movie being played back owns it otherwise
+void key_event(chip8 *chip8_object_ptr, const keymap *map, const SDL_KeyboardEvent *event, int live_keys, hotkeys *controls){
+    int down = (event->type == SDL_KEYDOWN);
+
+    switch(event->keysym.scancode){
+        case SDL_SCANCODE_BACKSPACE:
+            controls->rewind = down;
+            break;
+        case SDL_SCANCODE_F5:
+            if(down) controls->save_state = 1;
+            break;
+        case SDL_SCANCODE_F9:
+            if(down) controls->load_state = 1;
+            break;
+        default:
+            break;
+    }
+
+    //Auto-repeat sends more downs for a held key, which doesn't change the mask
+    if(live_keys && map->keys[event->keysym.scancode] >= 0){
+        set_key(chip8_object_ptr, map->keys[event->keysym.scancode], down);
+    }
+}
+
+void user_input(chip8 *chip8_object_ptr, const keymap *map, int live_keys, hotkeys *controls){
     SDL_Event event;
-    
+
     while(SDL_PollEvent(&event)){
         switch(event.type){
             case SDL_QUIT:
                 chip8_object_ptr->state = NOT_RUNNING;
                 break;
-            case SDL_KEYDOWN:
-                switch(event.key.keysym.sym){
-                    case SDLK_1:
-                        chip8_object_ptr->keys[0x1] = 1;
-                        break;
-                    case SDLK_2:
-                         chip8_object_ptr->keys[0x2] = 1;
-                        break;
-                    case SDLK_3:
-                        chip8_object_ptr->keys[0x3] = 1;
-                        break;
-                    case SDLK_4:
-                        chip8_object_ptr->keys[0xC] = 1;
-                        break;
-
-                    case SDLK_q:
-                        chip8_object_ptr->keys[0x4] = 1;
-                        break;
-                    case SDLK_w:
-                         chip8_object_ptr->keys[0x5] = 1;
-                        break;
-                    case SDLK_e:
-                         chip8_object_ptr->keys[0x6] = 1;
-                        break;
-                    case SDLK_r:
-                         chip8_object_ptr->keys[0xD] = 1;
-                        break;
-                
-                    case SDLK_a:
-                        chip8_object_ptr->keys[0x7] = 1;
-                        break;
-                    case SDLK_s:
-                         chip8_object_ptr->keys[0x8] = 1;
-                        break;
-                    case SDLK_d:
-                         chip8_object_ptr->keys[0x9] = 1;
-                        break;
-                    case SDLK_f:
-                        chip8_object_ptr->keys[0xE] = 1;
-                        break;
-                
-                    case SDLK_z:
-                        chip8_object_ptr->keys[0xA] = 1;
-                        break;
-                    case SDLK_x:
-                         chip8_object_ptr->keys[0x0] = 1;
-                        break;
-                    case SDLK_c:
-                         chip8_object_ptr->keys[0xB] = 1;
-                        break;
-                    case SDLK_v:
-                        chip8_object_ptr->keys[0xF] = 1;
-                        break;
-                }
+            case SDL_WINDOWEVENT:
+                //The window contents may be gone after an expose/resize, draw the next frame again
+                mark_display_dirty(chip8_object_ptr, 0, SCREEN_HEIGHT(chip8_object_ptr) - 1);
                 break;
+            case SDL_KEYDOWN:
             case SDL_KEYUP:
-                switch(event.key.keysym.sym){
-                    case SDLK_1:
-                        chip8_object_ptr->keys[0x1] = 0;
-                        break;
-                    case SDLK_2:
-                        chip8_object_ptr->keys[0x2] = 0;
-                        break;
-                    case SDLK_3:
-                        chip8_object_ptr->keys[0x3] = 0;
-                        break;
-                    case SDLK_4:
-                        chip8_object_ptr->keys[0xC] = 0;
-                        break;
-
-                    case SDLK_q:
-                        chip8_object_ptr->keys[0x4] = 0;
-                        break;
-                    case SDLK_w:
-                        chip8_object_ptr->keys[0x5] = 0;
-                        break;
-                    case SDLK_e:
-                        chip8_object_ptr->keys[0x6] = 0;
-                        break;
-                    case SDLK_r:
-                        chip8_object_ptr->keys[0xD] = 0;
-                        break;
-                
-                    case SDLK_a:
-                        chip8_object_ptr->keys[0x7] = 0;
-                        break;
-                    case SDLK_s:
-                        chip8_object_ptr->keys[0x8] = 0;
-                        break;
-                    case SDLK_d:
-                        chip8_object_ptr->keys[0x9] = 0;
-                        break;
-                    case SDLK_f:
-                        chip8_object_ptr->keys[0xE] = 0;
-                        break;
-                
-                    case SDLK_z:
-                        chip8_object_ptr->keys[0xA] = 0;
-                        break;
-                    case SDLK_x:
-                        chip8_object_ptr->keys[0x0] = 0;
-                        break;
-                    case SDLK_c:
-                        chip8_object_ptr->keys[0xB] = 0;
-                        break;
-                    case SDLK_v:
-                        chip8_object_ptr->keys[0xF] = 0;
-                        break;
-                }
+                key_event(chip8_object_ptr, map, &event.key, live_keys, controls);
                 break;
             default:
                 break;
@@ -277,619 +399,551 @@ void user_input(chip8 *chip8_object_ptr){
     }
 }
 
-void set_register_value(chip8 *chip8_object_ptr, __uint16_t ins){
-    //Calculate register number from opcode
-    __uint8_t reg_num = second_nible;
-            
-    //Calculate value from opcode
-    __uint8_t value = (ins & 0x00ff);
+//Keyboard events only, between the instruction batches of a frame; everything else waits for user_input()
+void poll_keypad(chip8 *chip8_object_ptr, const keymap *map, hotkeys *controls){
+    SDL_Event event;
 
-    //Assign value to register
-    chip8_object_ptr->registers[reg_num] = value; 
+    SDL_PumpEvents();
+    while(SDL_PeepEvents(&event, 1, SDL_GETEVENT, SDL_KEYDOWN, SDL_KEYUP) > 0){
+        key_event(chip8_object_ptr, map, &event.key, 1, controls);
+    }
 }
 
-void add_register_value(chip8 *chip8_object_ptr, __uint16_t ins){
-    //Calculate register number from opcode
-    __uint8_t reg_num = second_nible;
-            
-    //Calculate value from opcode
-    __uint8_t value = (ins & 0x00ff);
-    
-    //Add value to register
-    chip8_object_ptr->registers[reg_num] += value; 
-}
+//Returns 0 when nothing changed since the last call and the frame was skipped
+int draw(SDL_Renderer *renderer, SDL_Texture *texture, chip8 *chip8_object_ptr, const video_options *options){
+    void *pixels;
+    int pitch;
+    //Indexed by a pixel's colour, PIXEL()
+    const __uint32_t palette[4] = {options->bg_color, options->fg_color, options->plane2_color, options->both_color};
 
-void clear_screen(chip8 *chip8_object_ptr){
-    memset(chip8_object_ptr->display, 0x0, 2048);
-}
+    if(!chip8_object_ptr->display_dirty){
+        return 0;
+    }
 
-void set_pc(chip8 *chip8_object_ptr, __uint16_t ins){
-    chip8_object_ptr->PC = (ins & 0x0fff);
-}
+    //Only the rows written since the last draw are re-uploaded, at the width of the current resolution
+    SDL_Rect rows = {
+        .x = 0,
+        .y = chip8_object_ptr->dirty_first_row,
+        .w = SCREEN_WIDTH(chip8_object_ptr),
+        .h = chip8_object_ptr->dirty_last_row - chip8_object_ptr->dirty_first_row + 1
+    };
 
-void set_i(chip8 *chip8_object_ptr, __uint16_t ins){
-    chip8_object_ptr->I = (ins & 0x0fff);
-}
+    //Low resolution only uses the top left 64x32 of the texture, that part is stretched over the window
+    SDL_Rect screen = {
+        .x = 0,
+        .y = 0,
+        .w = SCREEN_WIDTH(chip8_object_ptr),
+        .h = SCREEN_HEIGHT(chip8_object_ptr)
+    };
 
-void display_fun(chip8 *chip8_object_ptr, __uint16_t ins){
-            // 0xDXYN: Draw N-height sprite at coords X,Y; Read from memory location I;
-            //   Screen pixels are XOR'd with sprite bits, 
-            //   VF (Carry flag) is set if any screen pixels are set off; This is useful
-            //   for collision detection or other reasons.
-            uint8_t X = chip8_object_ptr->registers[second_nible] % 64;
-            uint8_t Y = chip8_object_ptr->registers[third_nible] % 32;
-            uint8_t n = fourth_nible;
-            const uint8_t orig_X = X; // Original X value
-
-            chip8_object_ptr->registers[0xF] = 0;  // Initialize carry flag to 0
-
-            // Loop over all N rows of the sprite
-            for (uint8_t i = 0; i < n; i++) {
-                // Get next byte/row of sprite data
-                const uint8_t sprite_data = chip8_object_ptr->RAM[chip8_object_ptr->I + i];
-                X = orig_X;   // Reset X for next row to draw
-
-                for (int8_t j = 7; j >= 0; j--) {
-                    // If sprite pixel/bit is on and display pixel is on, set carry flag
-                    if ((sprite_data & (1 << j)) && (chip8_object_ptr->display[Y * 64 + X])) {
-                        chip8_object_ptr->registers[0xF] = 1;  
-                    }
-
-                    // XOR display pixel with sprite pixel/bit to set it on or off
-                    (chip8_object_ptr->display[Y * 64 + X]) ^= (sprite_data & (1 << j));
-
-                    // Stop drawing this row if hit right edge of screen
-                    if (++X >= 64) break;
-                }
-
-                // Stop drawing entire sprite if hit bottom edge of screen
-                if (++Y >= 32) break;
-            }
-}
+    //Expand the 1-bit rows into the 128x64 streaming texture, the renderer scales it to the window
+    if(SDL_LockTexture(texture, &rows, &pixels, &pitch) != 0){
+        printf("Error locking texture: %s\n", SDL_GetError());
+        return 0;
+    }
 
-void draw(SDL_Renderer *renderer, chip8 *chip8_object_ptr){
-    SDL_Rect rect = {.x = 0, .y = 0, .w = 20, .h = 20};
-    
-    uint32_t fg_color = 0xFFFFFFFF;
-    uint32_t bg_color = 0x000000FF;
-
-    __uint8_t fg_r = (fg_color >> 24) & 0xFF;
-    __uint8_t fg_g = (fg_color >> 16) & 0xFF;
-    __uint8_t fg_b = (fg_color >> 8) & 0xFF;
-    __uint8_t fg_a = (fg_color >> 0) & 0xFF; 
-
-    __uint8_t bg_r = (bg_color >> 24) & 0xFF;
-    __uint8_t bg_g = (bg_color >> 16) & 0xFF;
-    __uint8_t bg_b = (bg_color >> 8) & 0xFF;
-    __uint8_t bg_a = (bg_color >> 0) & 0xFF;
-
-    for(__uint32_t i = 0; i < 2048; i++){
-        rect.x = (i % 64) * 20;
-        rect.y = (i / 64) * 20;
-
-       if(chip8_object_ptr->display[i]){
-            SDL_SetRenderDrawColor(renderer, fg_r, fg_g, fg_b, fg_a);
-            SDL_RenderFillRect(renderer, &rect);
-        }else{
-            SDL_SetRenderDrawColor(renderer, bg_r, bg_g, bg_b, bg_a);
-            SDL_RenderFillRect(renderer, &rect);  
+    for(int y = 0; y < rows.h; y++){
+        __uint32_t *row = (__uint32_t *)((__uint8_t *)pixels + y * pitch);
+
+        for(int word = 0; word < rows.w / 64; word++){
+            __uint64_t plane0 = chip8_object_ptr->display[0][rows.y + y][word];
+            __uint64_t plane1 = chip8_object_ptr->display[1][rows.y + y][word];
+
+            for(int x = 0; x < 64; x++){
+                row[word * 64 + x] = palette[((plane0 >> (63 - x)) & 1) | (((plane1 >> (63 - x)) & 1) << 1)];
+            }
         }
-    
-     
     }
+
+    SDL_UnlockTexture(texture);
+
+    SDL_RenderClear(renderer);
+    SDL_RenderCopy(renderer, texture, &screen, NULL);
     SDL_RenderPresent(renderer);
-}
 
-void call_subroutine(chip8 *chip8_object_ptr, __uint16_t ins){
-    //Update stack pointer
-    chip8_object_ptr->sp++;
-    
-    //Store the next instruction address on the stack
-    chip8_object_ptr->stack[chip8_object_ptr->sp] = chip8_object_ptr->PC + 2;
-    
-    //Go to subroutine
-    chip8_object_ptr->PC = (ins & 0x0fff);
+    chip8_object_ptr->display_dirty = 0;
+    return 1;
 }
 
-void return_from_subroutine(chip8 *chip8_object_ptr){
-    //Assign PC the value on the top of the stack
-    chip8_object_ptr->PC = chip8_object_ptr->stack[chip8_object_ptr->sp];
-    
-    //Update stack pointer
-    chip8_object_ptr->sp--;
+double elapsed_seconds(struct timespec *start, struct timespec *end){
+    return (end->tv_sec - start->tv_sec) + (end->tv_nsec - start->tv_nsec) / 1e9;
 }
 
-void skip_constant_equal(chip8 *chip8_object_ptr, __uint16_t ins){
-    if(chip8_object_ptr->registers[second_nible] == (ins & 0x00ff)){
-        chip8_object_ptr->PC+=2;
-    }
-}
+void print_state(chip8 *chip8_object_ptr){
+    printf("PC=0x%03X I=0x%03X SP=%d DT=%u ST=%u\n",
+        chip8_object_ptr->PC, chip8_object_ptr->I, (__int8_t)chip8_object_ptr->sp,
+        chip8_object_ptr->delay_timer, chip8_object_ptr->sound_timer);
 
-void skip_not_constant_equal(chip8 *chip8_object_ptr, __uint16_t ins){
-    if(chip8_object_ptr->registers[second_nible] != (ins & 0x00ff)){
-        chip8_object_ptr->PC+=2;
+    for(int i=0; i<16; i++){
+        printf("V%X=0x%02X%s", i, chip8_object_ptr->registers[i], (i == 15) ? "\n" : " ");
     }
-}
 
-void skip_register_equal(chip8 *chip8_object_ptr, __uint16_t ins){
-    if(chip8_object_ptr->registers[second_nible] == chip8_object_ptr->registers[third_nible]){
-        chip8_object_ptr->PC+=2;
+    //One character per pixel, '#' = on, '.' = off, at the current resolution;
+    //  'o' is a pixel lit only in the second plane, '@' one lit in both
+    for(int y=0; y<SCREEN_HEIGHT(chip8_object_ptr); y++){
+        for(int x=0; x<SCREEN_WIDTH(chip8_object_ptr); x++){
+            putchar(".#o@"[PIXEL(chip8_object_ptr, x, y)]);
+        }
+        putchar('\n');
     }
 }
 
-void skip_register_not_equal(chip8 *chip8_object_ptr, __uint16_t ins){
-    if(chip8_object_ptr->registers[second_nible] != chip8_object_ptr->registers[third_nible]){
-        chip8_object_ptr->PC+=2;
-    }
-}
+void run_headless(chip8 *chip8_object_ptr, long ips, long max_frames, long max_cycles, movie *movie_ptr,
+                  capture *capture_ptr, shared_export *export_ptr){
+    struct timespec start, end;
+    long frames = 0;
+    long cycles = 0;
 
-void jump_with_offset(chip8 *chip8_object_ptr, __uint16_t ins){
-    chip8_object_ptr->PC = ((ins & 0x0fff) + chip8_object_ptr->registers[0x0]);
-}
+    clock_gettime(CLOCK_MONOTONIC, &start);
 
-void random(chip8 *chip8_object_ptr, __uint16_t ins){
-    __uint8_t nn = ins & 0x00ff;
-    chip8_object_ptr->registers[second_nible] = (rand() % 256) & nn;
-}
+    //Same instruction/timer ratio as the windowed loop, but without pacing, input or rendering
+    //A limit of 0 means no limit on that axis, without either one a played back movie decides the length
+    while(!chip8_object_ptr->state){
+        if(max_frames && frames >= max_frames) break;
 
-void set_vx_vy(chip8 *chip8_object_ptr, __uint16_t ins){
-    chip8_object_ptr->registers[second_nible] = chip8_object_ptr->registers[third_nible];
-}
+        //Exported commands are the only live input here, a played back movie ignores them like it does the keyboard
+        if(export_ptr && (!movie_ptr || movie_ptr->recording)){
+            export_commands(export_ptr, chip8_object_ptr);
+            if(chip8_object_ptr->state) break;
+        }
 
-void binary_or(chip8 *chip8_object_ptr, __uint16_t ins){
-    chip8_object_ptr->registers[second_nible] |= chip8_object_ptr->registers[third_nible];
-}
+        if(movie_ptr){
+            if(movie_finished(movie_ptr, chip8_object_ptr)) break;
+            movie_frame(movie_ptr, chip8_object_ptr);
+        }
 
-void binary_and(chip8 *chip8_object_ptr, __uint16_t ins){
-    chip8_object_ptr->registers[second_nible] &= chip8_object_ptr->registers[third_nible];
-}
+        long batch = instructions_for_frame(chip8_object_ptr, ips);
 
-void binary_xor(chip8 *chip8_object_ptr, __uint16_t ins){
-    chip8_object_ptr->registers[second_nible] ^= chip8_object_ptr->registers[third_nible];
-}
+        //The cycle limit can end the run in the middle of a frame
+        if(max_cycles && max_cycles - cycles < batch){
+            cycles += execute_instructions(chip8_object_ptr, max_cycles - cycles);
+            break;
+        }
 
-void subtract_vx_vy(chip8 *chip8_object_ptr, __uint16_t ins){
-    __uint8_t carry = chip8_object_ptr->registers[second_nible] > chip8_object_ptr->registers[third_nible];
-    
-    chip8_object_ptr->registers[second_nible] -= chip8_object_ptr->registers[third_nible];
-    
-    chip8_object_ptr->registers[0xf] = carry;
-}
+        cycles += execute_instructions(chip8_object_ptr, batch);
 
-void subtract_vy_vx(chip8 *chip8_object_ptr, __uint16_t ins){
-    __uint8_t carry = chip8_object_ptr->registers[second_nible] < chip8_object_ptr->registers[third_nible];
-    
-    chip8_object_ptr->registers[second_nible] = chip8_object_ptr->registers[third_nible] - chip8_object_ptr->registers[second_nible];
+        //A machine that halted partway through the frame never finishes it
+        if(chip8_object_ptr->state) break;
 
-    chip8_object_ptr->registers[0xf] = carry;
-}
+        end_frame(chip8_object_ptr);
+        frames++;
 
-void add(chip8 *chip8_object_ptr, __uint16_t ins){
-    __uint16_t carry = (uint16_t)(chip8_object_ptr->registers[second_nible] + chip8_object_ptr->registers[third_nible] > 255);
-    
-    chip8_object_ptr->registers[second_nible] += chip8_object_ptr->registers[third_nible];
+        if(capture_ptr) capture_frame(capture_ptr, chip8_object_ptr);
+        if(export_ptr) export_frame(export_ptr, chip8_object_ptr);
 
-    chip8_object_ptr->registers[0xf] = carry;
-} 
+        check_profile_request(chip8_object_ptr);
+    }
 
-void shift_right(chip8 *chip8_object_ptr, __uint16_t ins){
-    //chip8_object_ptr->registers[second_nible] = chip8_object_ptr->registers[third_nible]; 
-    __uint8_t carry = chip8_object_ptr->registers[third_nible] & 0x01;
+    clock_gettime(CLOCK_MONOTONIC, &end);
 
-    chip8_object_ptr->registers[second_nible] = chip8_object_ptr->registers[third_nible] >> 1;
+    double seconds = elapsed_seconds(&start, &end);
 
-    chip8_object_ptr->registers[0xf] = carry;
+    printf("instructions=%ld frames=%ld seconds=%.6f ips=%.0f\n",
+        cycles, frames, seconds, seconds > 0 ? cycles / seconds : 0.0);
+    print_state(chip8_object_ptr);
 }
 
-void shift_left(chip8 *chip8_object_ptr, __uint16_t ins){
-    //chip8_object_ptr->registers[second_nible] = chip8_object_ptr->registers[third_nible]; 
-    __uint8_t carry = (chip8_object_ptr->registers[third_nible] & 0x80) >> 7;
-    
-    chip8_object_ptr->registers[second_nible] = chip8_object_ptr->registers[third_nible] << 1;
-        
-    chip8_object_ptr->registers[0xf] = carry;
-}
+//Refresh rate of the monitor the window is on, 60Hz when SDL doesn't know
+double display_refresh_rate(SDL_Window *screen){
+    SDL_DisplayMode mode;
 
-void store_memory(chip8 *chip8_object_ptr, __uint16_t ins){
-    __uint8_t n = second_nible;
-    
-    for(int i=0; i<=n; i++){
-        chip8_object_ptr->RAM[chip8_object_ptr->I + i] = chip8_object_ptr->registers[i];
+    if(SDL_GetWindowDisplayMode(screen, &mode) != 0 || mode.refresh_rate <= 0){
+        return 60.0;
     }
+    return mode.refresh_rate;
 }
 
-void load_memory(chip8 *chip8_object_ptr, __uint16_t ins){
-    __uint8_t n = second_nible;
-
-    for(int i=0; i<=n; i++){
-        chip8_object_ptr->registers[i] = chip8_object_ptr->RAM[chip8_object_ptr->I + i];
-    }
+double seconds_since(Uint64 start){
+    return (double)(SDL_GetPerformanceCounter() - start) / SDL_GetPerformanceFrequency();
 }
 
-void add_to_index(chip8 *chip8_object_ptr, __uint16_t ins){
-    chip8_object_ptr->I += chip8_object_ptr->registers[second_nible];
-}
+/*
+One emulated frame of the windowed loop, with everything that observes frame
+boundaries. With input_polls above 1 the frame's instructions run in that
+many batches and the keypad is read between them, so Ex9E/ExA1/Fx0A see a
+key within a fraction of a frame. Movies only record keys at frame starts,
+so a frame is never split while one is open. A capture gets every emulated
+frame, rewound frames aren't captured again. An export publishes every
+frame.
+*/
+void emulate_frame(chip8 *chip8_object_ptr, const scheduler_options *options, const keymap *map, hotkeys *controls,
+                   movie *movie_ptr, rewind_buffer *rewind, audio_output *audio, capture *capture_ptr,
+                   shared_export *export_ptr){
+    if(movie_ptr){
+        movie_frame(movie_ptr, chip8_object_ptr);
+        run_frame(chip8_object_ptr, options->ips);
+    }else{
+        long count = instructions_for_frame(chip8_object_ptr, options->ips);
+        int polls = options->input_polls;
 
-void decimal_conversion(chip8 *chip8_object_ptr, __uint16_t ins){
-    __uint8_t n = chip8_object_ptr->registers[second_nible];
-    __uint8_t values[] = {n / 100, (n % 100) / 10, (n % 100) % 10}; 
-    for(int i=0; i<3; i++){
-        chip8_object_ptr->RAM[chip8_object_ptr->I + i] = values[i];
+        for(int i=0; i<polls; i++){
+            if(i) poll_keypad(chip8_object_ptr, map, controls);
+            execute_instructions(chip8_object_ptr, count * (i + 1) / polls - count * i / polls);
+        }
+        if(!chip8_object_ptr->state) end_frame(chip8_object_ptr);
     }
+    if(rewind) rewind_push(rewind, chip8_object_ptr);
+    audio_frame(audio, chip8_object_ptr);
+    if(capture_ptr) capture_frame(capture_ptr, chip8_object_ptr);
+    if(export_ptr) export_frame(export_ptr, chip8_object_ptr);
 }
 
-void font_char(chip8 *chip8_object_ptr, __uint16_t ins){
-    chip8_object_ptr->I = (chip8_object_ptr->registers[second_nible]) * 5;
-}
+/*
+Windowed main loop. Emulation advances in whole frames (instructions_for_frame()
+instructions followed by a 60Hz timer tick), so a run behaves exactly like a
+headless one. Wall-clock time from a monotonic counter decides how many frames
+are due: speed scales it for fast-forward, turbo ignores it and emulates as many
+frames as fit until the next display refresh. Drawing happens once per display
+refresh, input at least that often (see emulate_frame()). A movie and the beeper see every frame boundary, so playback
+and beeps are frame exact no matter how frames fall between refreshes. While
+rewind is held, each refresh steps back one frame instead of emulating;
+rewinding and loading states are off while a movie is open, since they would
+break its frame numbering.
+When the machine is blocked in Fx0A with both timers stopped
+(blocked_on_key()) nothing is emulated or drawn: the loop sleeps in
+SDL_WaitEventTimeout() until an event arrives, and machine time resumes
+from there without catching up. A movie never parks, playback has no
+events to wake it. Exported commands don't wake SDL either, with an
+export the sleeps are short enough to poll them.
+*/
+void run_windowed(chip8 *chip8_object_ptr, const scheduler_options *options, SDL_Window *screen, SDL_Renderer *renderer,
+                  SDL_Texture *texture, const video_options *video, const keymap *map, audio_output *audio,
+                  movie *movie_ptr, rewind_buffer *rewind, capture *capture_ptr, shared_export *export_ptr,
+                  const char *state_path){
+    //Frames where draw() had something to show vs frames it skipped
+    unsigned long frames_drawn = 0;
+    unsigned long frames_skipped = 0;
+    unsigned long parked_waits = 0; //Refreshes spent asleep in SDL_WaitEventTimeout()
+
+    double refresh_interval = 1.0 / display_refresh_rate(screen);
+
+    Uint64 start = SDL_GetPerformanceCounter();
+    double last_time = 0.0; //Wall-clock seconds at the previous refresh
+    double next_refresh = 0.0; //Wall-clock seconds when the next refresh is due
+    double emulated_time = 0.0; //Seconds of machine time owed so far
+    __uint64_t frames_run = 0; //Frames emulated, chip8->frames goes backwards on rewind/load
+    hotkeys controls = {0};
 
-void set_vx_delaytimer(chip8 *chip8_object_ptr, __uint16_t ins){
-    chip8_object_ptr->registers[second_nible] = chip8_object_ptr->delay_timer;
-}
+    while(!chip8_object_ptr->state){
+        
+        //Live keys take over once a played back movie runs out
+        int live_keys = !movie_ptr || movie_ptr->recording || movie_finished(movie_ptr, chip8_object_ptr);
 
-void set_delaytimer_vx(chip8 *chip8_object_ptr, __uint16_t ins){
-    chip8_object_ptr->delay_timer = chip8_object_ptr->registers[second_nible];
-}
+        user_input(chip8_object_ptr, map, live_keys, &controls);
+        if(export_ptr && live_keys){
+            export_commands(export_ptr, chip8_object_ptr);
+        }
 
-void set_soundtimer_vx(chip8 *chip8_object_ptr, __uint16_t ins){
-    chip8_object_ptr->sound_timer = chip8_object_ptr->registers[second_nible];
-}
+        double now = seconds_since(start);
 
-void get_key(chip8 *chip8_object_ptr, __uint16_t ins){
-    static __uint8_t key_pressed = 0;
-    static __uint8_t key;
-    
-    __uint8_t i = 0;
-    
-    while((i < 16) && (!key_pressed)){
-        if(chip8_object_ptr->keys[i]){
-            key = i;
-            key_pressed = 1;
-            break;
+        if(controls.save_state){
+            if(write_state_file(chip8_object_ptr, state_path)){
+                printf("Saved state to %s\n", state_path);
+            }else{
+                printf("Error saving state to %s\n", state_path);
+            }
         }
-        i++;
-    }
+        if(controls.load_state && !movie_ptr){
+            if(read_state_file(chip8_object_ptr, state_path)){
+                printf("Loaded state from %s\n", state_path);
+            }else{
+                printf("Error loading state from %s\n", state_path);
+            }
+        }
+        //Presses seen between the batches of a frame are acted on here too, then forgotten
+        controls.save_state = 0;
+        controls.load_state = 0;
+
+        if(rewind && controls.rewind && !movie_ptr){
+            rewind_step(rewind, chip8_object_ptr);
+            audio_frame(audio, chip8_object_ptr);
+            if(export_ptr) export_frame(export_ptr, chip8_object_ptr);
+        }else if(options->turbo){
+            do{
+                emulate_frame(chip8_object_ptr, options, map, &controls, movie_ptr, rewind, audio, capture_ptr, export_ptr);
+            }while(!chip8_object_ptr->state && seconds_since(start) < next_refresh);
+        }else{
+            //After a stall (window dragged, machine suspended) don't try to catch up on everything missed
+            double elapsed = now - last_time;
+            if(elapsed > 0.25) elapsed = 0.25;
 
-    if(!key_pressed){
-        chip8_object_ptr->PC-=2;
-    }else{
-        if(chip8_object_ptr->keys[key]){
-            chip8_object_ptr->PC-=2;
+            emulated_time += elapsed * options->speed;
+
+            while(!chip8_object_ptr->state && frames_run < emulated_time * TIMER_HZ){
+                emulate_frame(chip8_object_ptr, options, map, &controls, movie_ptr, rewind, audio, capture_ptr, export_ptr);
+                frames_run++;
+            }
+        }
+        last_time = now;
+
+        check_profile_request(chip8_object_ptr);
+
+        if(draw(renderer, texture, chip8_object_ptr, video)){
+            frames_drawn++;
         }else{
-            chip8_object_ptr->registers[second_nible] = key;
-            key = -1;
-            key_pressed = 0;
+            frames_skipped++;
+        }
+
+        //Parked in Fx0A: sleep until SDL has an event for user_input(), machine time doesn't pass meanwhile
+        if(!movie_ptr && !controls.rewind && blocked_on_key(chip8_object_ptr)){
+            SDL_WaitEventTimeout(NULL, export_ptr ? EXPORT_PARK_TIMEOUT_MS : PARK_TIMEOUT_MS);
+            parked_waits++;
+
+            last_time = seconds_since(start);
+            next_refresh = last_time;
+            continue;
+        }
+
+        //Deadlines are absolute so sleeping never accumulates drift; missed ones are skipped
+        next_refresh += refresh_interval;
+        now = seconds_since(start);
+        if(next_refresh < now){
+            next_refresh = now + refresh_interval;
         }
-    }
-}
 
-void skip_if_key(chip8 *chip8_object_ptr, __uint16_t ins){
-    if(chip8_object_ptr->keys[chip8_object_ptr->registers[second_nible]]){
-        chip8_object_ptr->PC+=2;
+        SDL_Delay((Uint32)((next_refresh - now) * 1000));
     }
+
+    printf("Frames drawn: %lu, skipped: %lu, parked waits: %lu\n", frames_drawn, frames_skipped, parked_waits);
 }
 
-void skip_if_not_key(chip8 *chip8_object_ptr, __uint16_t ins){
-    if(!chip8_object_ptr->keys[chip8_object_ptr->registers[second_nible]]){
-        chip8_object_ptr->PC+=2;
-    }
+void usage(void){
+    printf("Usage: ./chip8 [--engine interpreter|block|jit|aot] [--headless (--cycles N | --frames N)]\n"
+           "               [--ips N] [--speed X | --turbo] [--record FILE | --play FILE]\n"
+           "               [--rewind SECONDS] [--rewind-memory MB] [--state FILE] [--profile]\n"
+           "               [--trace FILE [--trace-records N]]\n"
+           "               [--capture FILE [--capture-format raw|y4m|png] [--capture-scale N] [--capture-drop]]\n"
+           "               [--export NAME] [--cache-dir DIR] [--quirks default|vip|schip|xo]\n"
+           "               [--tone HZ] [--volume PERCENT] [--audio-buffer SAMPLES]\n"
+           "               [--fg RRGGBB] [--bg RRGGBB] [--scale nearest|linear]\n"
+           "               [--keymap FILE] [--input-polls N] [--no-idle-skip] <rom name>\n");
+    exit(1);
 }
 
-void decrement_delay_timer(chip8 *chip8_obj_ptr){
-    if(chip8_obj_ptr->delay_timer > 0){
-        chip8_obj_ptr->delay_timer--;
+__uint32_t parse_color(const char *arg){
+    char *end;
+    unsigned long value = strtoul(arg, &end, 16);
+
+    if(strlen(arg) != 6 || *end != '\0'){
+        printf("Invalid colour (expected RRGGBB): %s\n", arg);
+        exit(1);
     }
+    return 0xFF000000 | (__uint32_t)value;
 }
 
-void decrement_sound_timer(chip8 *chip8_obj_ptr, SDL_AudioDeviceID *dev){
-    if(chip8_obj_ptr->sound_timer > 0){
-        SDL_PauseAudioDevice(*dev, 0);
-        chip8_obj_ptr->sound_timer--;
-    }else{
-        SDL_PauseAudioDevice(*dev, 1);
-    }
+//Format from the file name when --capture-format isn't given: a frame number pattern is a PNG sequence
+capture_formats capture_format_of(const char *path){
+    const char *extension = strrchr(path, '.');
+
+    if(strchr(path, '%')) return CAPTURE_PNG;
+    if(extension && !strcmp(extension, ".y4m")) return CAPTURE_Y4M;
+    return CAPTURE_RAW;
 }
 
-void debug(chip8 *chip8_obj_ptr, __uint16_t ins){
-    
-    printf("%hx  ", chip8_obj_ptr->PC);
-    
-    switch (first_nible)
-    {
-    case 0x0:
-        if(ins & 0x00e0){
-            // 0x00E0: Clear the screen
-            printf("Clear screen\n");
-        }else if(ins & 0x00ee){
-            // 0x00E0: Return from subroutine
-            printf("Return from subroutine to address 0x%04X\n",
-            chip8_obj_ptr->stack[chip8_obj_ptr->sp]);
-        }else{
-            printf("Uniplimented opcode\n");
-        }
-        break;
-    case 0x1:
-        // 0x1NNN: Jump to address NNN
-        printf("Jump to address NNN (0x%04X)\n",
-            (ins & 0x0fff));   
-        break;
-    case 0x2:
-        // 0x2NNN: Call subroutine at NNN
-        printf("Call subroutine at NNN (0x%04X)\n",
-            (ins & 0x0fff));
-        break;
-    case 0x3:
-        // 0x3XNN: Check if VX == NN, if so, skip the next instruction
-        printf("Check if V%X (0x%02X) == NN (0x%02X), skip next instruction if true\n",
-                   second_nible, chip8_obj_ptr->registers[second_nible], ins & 0x00ff);
-        break;
-    case 0x4:
-        // 0x4XNN: Check if VX != NN, if so, skip the next instruction
-        printf("Check if V%X (0x%02X) != NN (0x%02X), skip next instruction if true\n",
-                   second_nible, chip8_obj_ptr->registers[second_nible], ins & 0x00ff);
-        break;
-    case 0x5:
-        // 0x5XY0: Check if VX == VY, if so, skip the next instruction
-        printf("Check if V%X (0x%02X) == V%X (0x%02X), skip next instruction if true\n",
-            second_nible, chip8_obj_ptr->registers[second_nible], 
-            third_nible, chip8_obj_ptr->registers[third_nible]);
-        break;
-    case 0x06:
-        // 0x6XNN: Set register VX to NN
-        printf("Set register V%X = NN (0x%02X)\n",
-            second_nible, ins & 0x00ff);
-        break;
-    case 0x07:
-        // 0x7XNN: Set register VX += NN
-        printf("Set register V%X (0x%02X) += NN (0x%02X). Result: 0x%02X\n",
-            second_nible, chip8_obj_ptr->registers[second_nible], ins & 0x00ff,
-            chip8_obj_ptr->registers[second_nible] + (ins & 0x00ff));
-        break;
-    case 0x8:
-        switch (fourth_nible)
-        {
-        
-        case 0:
-            // 0x8XY0: Set register VX = VY
-            printf("Set register V%X = V%X (0x%02X)\n",
-                second_nible, third_nible, chip8_obj_ptr->registers[third_nible]);
-            break;
-        case 1:
-            // 0x8XY1: Set register VX |= VY
-            printf("Set register V%X (0x%02X) |= V%X (0x%02X); Result: 0x%02X\n",
-                second_nible, chip8_obj_ptr->registers[second_nible],
-                third_nible, chip8_obj_ptr->registers[third_nible],
-                chip8_obj_ptr->registers[second_nible] | chip8_obj_ptr->registers[third_nible]);
-            break;
-        case 2:
-            // 0x8XY2: Set register VX &= VY
-            printf("Set register V%X (0x%02X) &= V%X (0x%02X); Result: 0x%02X\n",
-                second_nible, chip8_obj_ptr->registers[second_nible],
-                third_nible, chip8_obj_ptr->registers[third_nible],
-                chip8_obj_ptr->registers[second_nible] & chip8_obj_ptr->registers[third_nible]);
-            break;
-        case 3:
-            // 0x8XY3: Set register VX ^= VY
-            printf("Set register V%X (0x%02X) ^= V%X (0x%02X); Result: 0x%02X\n",
-                second_nible, chip8_obj_ptr->registers[second_nible],
-                third_nible, chip8_obj_ptr->registers[third_nible],
-                chip8_obj_ptr->registers[second_nible] ^ chip8_obj_ptr->registers[third_nible]);
-             break;
-        case 4:
-            // 0x8XY4: Set register VX += VY, set VF to 1 if carry
-            printf("Set register V%X (0x%02X) += V%X (0x%02X), VF = 1 if carry; Result: 0x%02X, VF = %X\n",
-                second_nible, chip8_obj_ptr->registers[second_nible],
-                third_nible, chip8_obj_ptr->registers[third_nible],
-                chip8_obj_ptr->registers[second_nible] + chip8_obj_ptr->registers[third_nible],
-                ((uint16_t)chip8_obj_ptr->registers[second_nible] + chip8_obj_ptr->registers[third_nible]) > 255);
-            break;
-        case 5:
-            // 0x8XY5: Set register VX -= VY, set VF to 1 if there is not a borrow (result is positive/0)
-            printf("Set register V%X (0x%02X) -= V%X (0x%02X), VF = 1 if no borrow; Result: 0x%02X, VF = %X\n",
-                second_nible, chip8_obj_ptr->registers[second_nible],
-                third_nible, chip8_obj_ptr->registers[third_nible],
-                chip8_obj_ptr->registers[second_nible] - chip8_obj_ptr->registers[third_nible],
-                (chip8_obj_ptr->registers[second_nible] <= chip8_obj_ptr->registers[third_nible]));
-            break;
-        case 6:
-            // 0x8XY6: Set register VX >>= 1, store shifted off bit in VF
-            printf("Set register V%X (0x%02X) >>= 1, VF = shifted off bit (%X); Result: 0x%02X\n",
-                second_nible, chip8_obj_ptr->registers[second_nible],
-                chip8_obj_ptr->registers[second_nible] & 1,
-                chip8_obj_ptr->registers[second_nible] >> 1);
-            break;
-        case 7:
-            // 0x8XY7: Set register VX = VY - VX, set VF to 1 if there is not a borrow (result is positive/0)
-            printf("Set register V%X = V%X (0x%02X) - V%X (0x%02X), VF = 1 if no borrow; Result: 0x%02X, VF = %X\n",
-                second_nible, third_nible, chip8_obj_ptr->registers[third_nible],
-                second_nible, chip8_obj_ptr->registers[second_nible],
-                chip8_obj_ptr->registers[third_nible] - chip8_obj_ptr->registers[second_nible],
-                (chip8_obj_ptr->registers[second_nible] <= chip8_obj_ptr->registers[third_nible]));
-            break;
-        case 0xE:
-            // 0x8XYE: Set register VX <<= 1, store shifted off bit in VF
-            printf("Set register V%X (0x%02X) <<= 1, VF = shifted off bit (%X); Result: 0x%02X\n",
-                second_nible, chip8_obj_ptr->registers[second_nible],
-                (chip8_obj_ptr->registers[second_nible] >> 7) & 0x1,
-                chip8_obj_ptr->registers[second_nible] << 1);
-            break;
-        }
-    break;
-    case 0x9:
-        // 0x9XY0: Check if VX != VY; Skip next instruction if so
-        printf("Check if V%X (0x%02X) != V%X (0x%02X), skip next instruction if true\n",
-            second_nible, chip8_obj_ptr->registers[second_nible], 
-            third_nible, chip8_obj_ptr->registers[third_nible]);
-        break;
-    case 0xa:
-        // 0xANNN: Set index register I to NNN
-        printf("Set I to NNN (0x%04X)\n",
-            ins & 0x0fff);
-        break;
-    case 0xb:
-        // 0xBNNN: Jump to V0 + NNN
-        printf("Set PC to V0 (0x%02X) + NNN (0x%04X); Result PC = 0x%04X\n",
-            chip8_obj_ptr->registers[0x0], ins & 0x0fff, chip8_obj_ptr->registers[0x0] + (ins & 0x0fff));
-        break;
-    case 0xc:
-        // 0xCXNN: Sets register VX = rand() % 256 & NN (bitwise AND)
-        printf("Set V%X = rand() %% 256 & NN (0x%02X)\n",
-            second_nible, ins & 0x00ff);
-        break;
-    case 0xd:
-        // 0xDXYN: Draw N-height sprite at coords X,Y; Read from memory location I;
-        //   Screen pixels are XOR'd with sprite bits, 
-        //   VF (Carry flag) is set if any screen pixels are set off; This is useful
-        //   for collision detection or other reasons.
-        printf("Draw N (%u) height sprite at coords V%X (0x%02X), V%X (0x%02X) "
-            "from memory location I (0x%04X). Set VF = 1 if any pixels are turned off.\n",
-            fourth_nible, second_nible, chip8_obj_ptr->registers[second_nible], third_nible,
-            chip8_obj_ptr->registers[third_nible], chip8_obj_ptr->I);
-        break;
-    default:
-        break;
+long parse_count(const char *arg){
+    char *end;
+    long value = strtol(arg, &end, 10);
+
+    if(*arg == '\0' || *end != '\0' || value <= 0){
+        printf("Invalid count: %s\n", arg);
+        exit(1);
     }
+    return value;
 }
 
-void execute_instruction(chip8 *chip8_object_ptr){
-    __uint8_t opcode1 = chip8_object_ptr->RAM[chip8_object_ptr->PC];
-    __uint8_t opcode2 = chip8_object_ptr->RAM[chip8_object_ptr->PC + 1];
+int main(int argc, char **argv){
     
-    __uint16_t ins = ((__uint16_t)opcode1 << 8 ) | opcode2;
-    /*
-    first_nible is the first 4 bits of the ins var
-    which decide the category of the opcode
-    */
-    #ifdef DEBUG
-    debug(chip8_object_ptr, ins);
-    #endif
-
-    switch(first_nible){
-        case 0x0:
-            if(second_nible == 0x0 && third_nible == 0xe && fourth_nible == 0x0){
-                clear_screen(chip8_object_ptr);
-            }else if(second_nible == 0x0 && third_nible == 0xe && fourth_nible == 0xe){
-                return_from_subroutine(chip8_object_ptr);
-                chip8_object_ptr->PC-=2;
+    //64 KB of RAM plus the caches sized by it, too big for the stack
+    static chip8 chip8_object;
+    chip8 *chip8_object_ptr = &chip8_object;
+
+    SDL_Window *screen;
+    SDL_Renderer *renderer;
+    SDL_Texture *texture;
+
+    video_options video = {
+        .fg_color = 0xFFFFFFFF,
+        .bg_color = 0xFF000000,
+        .plane2_color = 0xFF555555,
+        .both_color = 0xFFAAAAAA,
+        .scale_quality = "nearest",
+    };
+
+    audio_options sound = {
+        .frequency = 440,
+        .volume = 10,
+        .buffer_samples = 512,
+    };
+    audio_output audio;
+
+    int headless = 0;
+    int profiling = 0;
+    int skip_idle = 1;
+    const char *trace_name = NULL;
+    long trace_records = 1 << 22;
+    long max_frames = 0;
+    long max_cycles = 0;
+    const char *rom_name = NULL;
+    const char *record_name = NULL;
+    const char *play_name = NULL;
+    movie input_movie;
+    movie *movie_ptr = NULL;
+    long rewind_seconds = 0;
+    long rewind_megabytes = 8;
+    rewind_buffer *rewind = NULL;
+    const char *state_path = NULL;
+    char default_state_path[4096];
+    const char *capture_name = NULL;
+    int capture_format = -1; //-1 = from the file name
+    long capture_scale = 1;
+    capture_policies capture_policy = CAPTURE_BLOCK;
+    capture *capture_ptr = NULL;
+    const char *export_name = NULL;
+    const char *cache_directory = NULL;
+    shared_export *export_ptr = NULL;
+    engines engine = ENGINE_INTERPRETER;
+    int quirks = QUIRKS_DEFAULT;
+
+    scheduler_options scheduler = {
+        .ips = DEFAULT_IPS,
+        .speed = 1.0,
+        .turbo = 0,
+        .input_polls = 1,
+    };
+
+    keymap map;
+    default_keymap(&map);
+
+    for(int i=1; i<argc; i++){
+        if(!strcmp(argv[i], "--headless")){
+            headless = 1;
+        }else if(!strcmp(argv[i], "--cycles") && i + 1 < argc){
+            max_cycles = parse_count(argv[++i]);
+        }else if(!strcmp(argv[i], "--frames") && i + 1 < argc){
+            max_frames = parse_count(argv[++i]);
+        }else if(!strcmp(argv[i], "--engine") && i + 1 < argc){
+            i++;
+            if(!strcmp(argv[i], "interpreter")){
+                engine = ENGINE_INTERPRETER;
+            }else if(!strcmp(argv[i], "block")){
+                engine = ENGINE_BLOCK;
+            }else if(!strcmp(argv[i], "jit")){
+                engine = ENGINE_JIT;
+            }else if(!strcmp(argv[i], "aot")){
+                engine = ENGINE_AOT;
             }else{
-                printf("Unimplemented\n");
+                usage();
             }
-            break;
-        case 0x1:
-            set_pc(chip8_object_ptr, ins);
-            chip8_object_ptr->PC-=2;
-            break;
-        case 0x2:
-            call_subroutine(chip8_object_ptr, ins);
-            chip8_object_ptr->PC-=2;
-            break;
-        case 0x3:
-            skip_constant_equal(chip8_object_ptr, ins);
-            break;
-        case 0x4:
-            skip_not_constant_equal(chip8_object_ptr, ins);
-            break;
-        case 0x5:
-            skip_register_equal(chip8_object_ptr, ins);
-            break;
-        case 0x6:
-            set_register_value(chip8_object_ptr, ins); 
-            break;
-        case 0x7:
-            add_register_value(chip8_object_ptr, ins);
-            break;
-        case 0x8:
-            if(fourth_nible == 0x0){
-                set_vx_vy(chip8_object_ptr, ins);
-            }else if(fourth_nible == 0x1){
-                binary_or(chip8_object_ptr, ins);
-            }else if(fourth_nible == 0x2){
-                binary_and(chip8_object_ptr, ins);
-            }else if(fourth_nible == 0x3){
-                binary_xor(chip8_object_ptr, ins);
-            }else if(fourth_nible == 0x4){
-                add(chip8_object_ptr, ins);
-            }else if(fourth_nible == 0x5){
-                subtract_vx_vy(chip8_object_ptr, ins);
-            }else if(fourth_nible == 0x6){
-                shift_right(chip8_object_ptr, ins);
-            }else if(fourth_nible == 0x7){
-                subtract_vy_vx(chip8_object_ptr, ins);
-            }else if(fourth_nible == 0xe){
-                shift_left(chip8_object_ptr, ins);
+        }else if(!strcmp(argv[i], "--ips") && i + 1 < argc){
+            scheduler.ips = parse_count(argv[++i]);
+        }else if(!strcmp(argv[i], "--speed") && i + 1 < argc){
+            scheduler.speed = strtod(argv[++i], NULL);
+            if(scheduler.speed <= 0){
+                usage();
             }
-            break;
-        case 0x9:
-            skip_register_not_equal(chip8_object_ptr, ins);
-            break;
-        case 0xA:
-            set_i(chip8_object_ptr, ins);
-            break;
-        case 0xB:
-            jump_with_offset(chip8_object_ptr, ins);
-            chip8_object_ptr->PC-=2;
-            break;
-        case 0xC:
-            random(chip8_object_ptr, ins);
-            break;
-        case 0xD:
-            display_fun(chip8_object_ptr, ins);
-            break;
-        case 0xE:
-            if((ins & 0x00ff) == 0x9e){
-                skip_if_key(chip8_object_ptr, ins);
+        }else if(!strcmp(argv[i], "--record") && i + 1 < argc){
+            record_name = argv[++i];
+        }else if(!strcmp(argv[i], "--play") && i + 1 < argc){
+            play_name = argv[++i];
+        }else if(!strcmp(argv[i], "--rewind") && i + 1 < argc){
+            rewind_seconds = parse_count(argv[++i]);
+        }else if(!strcmp(argv[i], "--rewind-memory") && i + 1 < argc){
+            rewind_megabytes = parse_count(argv[++i]);
+        }else if(!strcmp(argv[i], "--state") && i + 1 < argc){
+            state_path = argv[++i];
+        }else if(!strcmp(argv[i], "--trace") && i + 1 < argc){
+            trace_name = argv[++i];
+        }else if(!strcmp(argv[i], "--trace-records") && i + 1 < argc){
+            trace_records = parse_count(argv[++i]);
+        }else if(!strcmp(argv[i], "--capture") && i + 1 < argc){
+            capture_name = argv[++i];
+        }else if(!strcmp(argv[i], "--capture-format") && i + 1 < argc){
+            i++;
+            if(!strcmp(argv[i], "raw")){
+                capture_format = CAPTURE_RAW;
+            }else if(!strcmp(argv[i], "y4m")){
+                capture_format = CAPTURE_Y4M;
+            }else if(!strcmp(argv[i], "png")){
+                capture_format = CAPTURE_PNG;
             }else{
-                skip_if_not_key(chip8_object_ptr, ins);
+                usage();
             }
-            break;
-        case 0xF:
-            if((ins & 0x00ff) == 0x55){
-                store_memory(chip8_object_ptr, ins);
-            }else if((ins & 0x00ff) == 0x65){
-                load_memory(chip8_object_ptr, ins);
-            }else if((ins & 0x00ff) == 0x1e){
-                add_to_index(chip8_object_ptr, ins);
-            }else if((ins & 0x00ff) == 0x33){
-                decimal_conversion(chip8_object_ptr, ins);
-            }else if((ins & 0x00ff) == 0x29){
-                font_char(chip8_object_ptr, ins);
-            }else if((ins & 0x00ff) == 0x07){
-                set_vx_delaytimer(chip8_object_ptr, ins);
-            }else if((ins & 0x00ff) == 0x15){
-                set_delaytimer_vx(chip8_object_ptr, ins);
-            }else if((ins & 0x00ff) == 0x18){
-                set_soundtimer_vx(chip8_object_ptr, ins);
-            }else if((ins & 0x00ff) == 0x0A){
-                get_key(chip8_object_ptr, ins);
+        }else if(!strcmp(argv[i], "--capture-scale") && i + 1 < argc){
+            capture_scale = parse_count(argv[++i]);
+            if(capture_scale > 16){
+                usage();
             }
-            break;
-        default:
-            printf("Unknown instuction ");
-            printf("-> %hx\n", ins);
-            break;
+        }else if(!strcmp(argv[i], "--capture-drop")){
+            capture_policy = CAPTURE_DROP;
+        }else if(!strcmp(argv[i], "--cache-dir") && i + 1 < argc){
+            cache_directory = argv[++i];
+        }else if(!strcmp(argv[i], "--quirks") && i + 1 < argc){
+            quirks = quirk_profile_from_name(argv[++i]);
+            if(quirks < 0){
+                usage();
+            }
+        }else if(!strcmp(argv[i], "--export") && i + 1 < argc){
+            export_name = argv[++i];
+        }else if(!strcmp(argv[i], "--no-idle-skip")){
+            skip_idle = 0;
+        }else if(!strcmp(argv[i], "--profile")){
+            profiling = 1;
+        }else if(!strcmp(argv[i], "--turbo")){
+            scheduler.turbo = 1;
+        }else if(!strcmp(argv[i], "--tone") && i + 1 < argc){
+            sound.frequency = parse_count(argv[++i]);
+            if(sound.frequency > 20000){
+                usage();
+            }
+        }else if(!strcmp(argv[i], "--volume") && i + 1 < argc){
+            sound.volume = atoi(argv[++i]);
+            if(sound.volume < 0 || sound.volume > 100){
+                usage();
+            }
+        }else if(!strcmp(argv[i], "--audio-buffer") && i + 1 < argc){
+            sound.buffer_samples = parse_count(argv[++i]);
+            if(sound.buffer_samples > 32768){
+                usage();
+            }
+        }else if(!strcmp(argv[i], "--fg") && i + 1 < argc){
+            video.fg_color = parse_color(argv[++i]);
+        }else if(!strcmp(argv[i], "--bg") && i + 1 < argc){
+            video.bg_color = parse_color(argv[++i]);
+        }else if(!strcmp(argv[i], "--keymap") && i + 1 < argc){
+            load_keymap(&map, argv[++i]);
+        }else if(!strcmp(argv[i], "--input-polls") && i + 1 < argc){
+            scheduler.input_polls = parse_count(argv[++i]);
+            if(scheduler.input_polls > 64){
+                usage();
+            }
+        }else if(!strcmp(argv[i], "--scale") && i + 1 < argc){
+            i++;
+            if(strcmp(argv[i], "nearest") && strcmp(argv[i], "linear")){
+                usage();
+            }
+            video.scale_quality = argv[i];
+        }else if(argv[i][0] != '-' && !rom_name){
+            rom_name = argv[i];
+        }else{
+            usage();
+        }
     }
-    
-    chip8_object_ptr->PC+=2;
-
-}
 
-int main(int argc, char **argv){
-    
-    chip8 chip8_object;
-    chip8 *chip8_object_ptr = &chip8_object;
-
-    SDL_Window *screen;
-    SDL_Renderer *renderer;
+    //Check if user provided ROM name
+    if(!rom_name){
+        usage();
+    }
 
-    SDL_AudioSpec want, have;
-    SDL_AudioDeviceID dev;
+    if(record_name && play_name){
+        usage();
+    }
 
-    //Check if user provided ROM name
-    if(argc != 2){
-        printf("Usage: ./chip8 <rom name>\n");
-        exit(1);
+    //Headless runs must terminate on their own, a played back movie ends where its recording did
+    if(headless && !max_frames && !max_cycles && !play_name){
+        usage();
     }
 
-    FILE *rom = fopen(argv[1], "r");
+    FILE *rom = fopen(rom_name, "r");
 
     //Check if everything went ok opening ROM
     if(rom == NULL){
@@ -898,30 +952,101 @@ int main(int argc, char **argv){
     }
 
     initialize_chip8(chip8_object_ptr, rom);
-       
-    //SDL setup
-    initialize_sdl(&screen, &renderer, &dev, &want, &have);
-    
-    srand(time(NULL));
+    fclose(rom);
+    chip8_object_ptr->skip_idle = skip_idle;
+
+    //A movie carries the seed, instruction rate and quirk profile, everything else about the run is replayed from keys alone
+    if(play_name){
+        movie_ptr = &input_movie;
+        start_playback(movie_ptr, play_name);
+        scheduler.ips = movie_ptr->ips;
+        quirks = movie_ptr->quirks;
+        seed_chip8(chip8_object_ptr, movie_ptr->seed);
+    }else if(record_name){
+        movie_ptr = &input_movie;
+        start_recording(movie_ptr, record_name, (__uint32_t)time(NULL), scheduler.ips, quirks);
+        seed_chip8(chip8_object_ptr, movie_ptr->seed);
+    }else{
+        seed_chip8(chip8_object_ptr, (__uint32_t)time(NULL));
+    }
 
-    //Main loop
-    while(!chip8_object_ptr->state){
-        
-        user_input(chip8_object_ptr);
-        
-        for(int i=0; i<700/60; i++)
-            execute_instruction(chip8_object_ptr);
-        
-        SDL_Delay(16.6);
-        
-        decrement_delay_timer(chip8_object_ptr);
-        decrement_sound_timer(chip8_object_ptr, &dev);
+    //Picks the decode tables, before anything is decoded for the cache or an engine
+    set_quirks(chip8_object_ptr, quirks);
 
-        draw(renderer, chip8_object_ptr);
+    //Reachable code comes decoded from the cache, or is analysed now and cached for the next run
+    if(cache_directory){
+        load_rom_cache(chip8_object_ptr, cache_directory);
     }
 
+#ifdef AOT_PROGRAM
+    chip8_object_ptr->aot_program = &aot_builtin_program;
+#endif
+
+    //Before the engine is picked, the JIT can't record traces
+    if(trace_name){
+        start_trace(chip8_object_ptr, trace_name, trace_records);
+    }
+
+    set_engine(chip8_object_ptr, engine);
+
+    //Counters are printed to stderr at exit, and whenever SIGUSR1 arrives
+    if(profiling){
+        enable_profile(chip8_object_ptr);
+        signal(SIGUSR1, request_profile);
+    }
+
+    //Frames are encoded on a thread of their own, the emulation loop only copies the display
+    if(capture_name){
+        const __uint32_t palette[4] = {video.bg_color, video.fg_color, video.plane2_color, video.both_color};
+
+        if(capture_format < 0){
+            capture_format = capture_format_of(capture_name);
+        }
+        capture_ptr = start_capture(capture_name, capture_format, capture_scale, capture_policy, palette);
+    }
+
+    //Other processes watch the machine and send keys through shared memory, see shared.c
+    if(export_name){
+        export_ptr = start_export(export_name);
+        export_frame(export_ptr, chip8_object_ptr);
+    }
+
+    if(headless){
+        run_headless(chip8_object_ptr, scheduler.ips, max_frames, max_cycles, movie_ptr, capture_ptr, export_ptr);
+        print_profile(stderr, chip8_object_ptr);
+        if(movie_ptr) stop_movie(movie_ptr, chip8_object_ptr);
+        if(capture_ptr) stop_capture(capture_ptr);
+        if(export_ptr) stop_export(export_ptr, chip8_object_ptr);
+        destroy_chip8(chip8_object_ptr);
+        return 0;
+    }
+       
+    //F5/F9 save and load next to the ROM unless told otherwise
+    if(!state_path){
+        snprintf(default_state_path, sizeof default_state_path, "%s.state", rom_name);
+        state_path = default_state_path;
+    }
+
+    if(rewind_seconds){
+        rewind = create_rewind_buffer(rewind_seconds, (size_t)rewind_megabytes << 20);
+    }
+
+    //SDL setup
+    initialize_sdl(&screen, &renderer, &texture, &video);
+    open_audio(&audio, &sound);
+
+    run_windowed(chip8_object_ptr, &scheduler, screen, renderer, texture, &video, &map, &audio, movie_ptr, rewind,
+                 capture_ptr, export_ptr, state_path);
+    print_profile(stderr, chip8_object_ptr);
+    if(movie_ptr) stop_movie(movie_ptr, chip8_object_ptr);
+    if(capture_ptr) stop_capture(capture_ptr);
+    if(export_ptr) stop_export(export_ptr, chip8_object_ptr);
+    destroy_rewind_buffer(rewind);
+
     //SDL Destroy
-    destroy_sdl(screen, &dev);    
+    close_audio(&audio);
+    destroy_sdl(screen, renderer, texture);    
+    destroy_chip8(chip8_object_ptr);
     
     return 0;
-}
\ No newline at end of file
+}
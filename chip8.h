@@ -0,0 +1,554 @@
+#ifndef CHIP8_H
+#define CHIP8_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#define first_nible (ins & 0xf000) >> 12
+#define second_nible (ins & 0x0f00) >> 8
+#define third_nible (ins & 0x00f0) >> 4
+#define fourth_nible (ins & 0x000f)
+
+//Instructions per second unless configured otherwise
+#define DEFAULT_IPS 700
+
+//Rate of the delay and sound timers, a frame is the time between two ticks
+#define TIMER_HZ 60
+
+//Size of the address space (XO-CHIP), addresses wrap around at this boundary
+#define RAM_SIZE 65536
+
+//Where programs are loaded, the largest ROM fills the rest of the address space
+#define PROGRAM_START 0x200
+#define MAX_ROM_SIZE (RAM_SIZE - PROGRAM_START)
+
+//Display size in pixels in SUPER-CHIP high resolution mode
+#define DISPLAY_WIDTH 128
+#define DISPLAY_HEIGHT 64
+
+//64-bit words per display row
+#define DISPLAY_WORDS (DISPLAY_WIDTH / 64)
+
+//XO-CHIP bitplanes, a pixel's colour is its bit in plane 0 plus twice its bit in plane 1
+#define DISPLAY_PLANES 2
+
+//Low resolution (CHIP-8) mode uses the top left quarter of the display
+#define LORES_WIDTH 64
+#define LORES_HEIGHT 32
+
+//Size of the display in the current mode
+#define SCREEN_WIDTH(chip8_object_ptr) ((chip8_object_ptr)->hires ? DISPLAY_WIDTH : LORES_WIDTH)
+#define SCREEN_HEIGHT(chip8_object_ptr) ((chip8_object_ptr)->hires ? DISPLAY_HEIGHT : LORES_HEIGHT)
+
+//Each display row is DISPLAY_WORDS 64-bit words per plane, pixel x of the row is bit 63 - x % 64 of word x / 64
+#define PLANE_PIXEL(chip8_object_ptr, plane, x, y) (((chip8_object_ptr)->display[plane][y][(x) >> 6] >> (63 - ((x) & 63))) & 1)
+
+//Colour 0-3 of a pixel
+#define PIXEL(chip8_object_ptr, x, y) (PLANE_PIXEL(chip8_object_ptr, 0, x, y) | (PLANE_PIXEL(chip8_object_ptr, 1, x, y) << 1))
+
+//Whether keypad key 0-F is held, only its low nibble counts
+#define KEY_DOWN(chip8_object_ptr, key) (((chip8_object_ptr)->keys >> ((key) & 0xf)) & 1)
+
+//Where the fonts live in RAM, 5 bytes per small glyph and 10 per large one
+#define FONT_ADDRESS 0x00
+#define BIG_FONT_ADDRESS 0x50
+
+//HP48 flag registers Fx75 saves V0..VX to, SUPER-CHIP has 8 and XO-CHIP 16
+#define RPL_FLAGS 16
+
+//XO-CHIP audio: a 128-bit sample pattern played at 4000 * 2^((pitch - 64) / 48) bits per second
+#define AUDIO_PATTERN_SIZE 16
+#define DEFAULT_PITCH 64
+
+//Depth of the subroutine stack
+#define STACK_SIZE 24
+
+//Granularity at which RAM writes are reported to the block engine
+#define CODE_PAGE_SIZE 64
+#define CODE_PAGES (RAM_SIZE / CODE_PAGE_SIZE)
+
+//Longest run of instructions the block engine and the JIT translate as one unit
+#define BLOCK_MAX_LENGTH 32
+
+typedef enum{
+    RUNNING,
+    NOT_RUNNING
+} states;
+
+typedef enum{
+    ENGINE_INTERPRETER, //One decoded instruction per dispatch, the reference implementation
+    ENGINE_BLOCK, //Cached straight-line blocks of handlers, see block.c
+    ENGINE_JIT, //Blocks recompiled to native x86-64 code, see jit.c
+    ENGINE_AOT //Blocks of one ROM compiled to C ahead of time by chip8-aot, see aot.c
+} engines;
+
+/*
+Behaviours that differ between the platforms CHIP-8 programs were written
+for, one row per profile:
+    shift_vy:    8xy6/8xyE shift VY into VX (VIP), or shift VX in place (SUPER-CHIP)
+    increment_i: Fx55/Fx65 leave I past the last register (VIP), or untouched
+    reset_vf:    8xy1/8xy2/8xy3 clear VF (VIP)
+    wrap:        Dxyn wraps sprites around the screen edges (XO-CHIP), or clips them
+Each profile gets its own decode tables built from this at compile time, so
+the quirks are settled when an opcode is decoded, never when it runs.
+DEFAULT is what this emulator has always done, it stays the default.
+*/
+#define QUIRK_PROFILES(X) \
+    /*    profile  name       shift_vy increment_i reset_vf wrap */ \
+    X(DEFAULT, "default", 1, 0, 0, 0) \
+    X(VIP,     "vip",     1, 1, 1, 0) \
+    X(SCHIP,   "schip",   0, 0, 0, 0) \
+    X(XO,      "xo",      1, 1, 0, 1)
+
+typedef enum{
+#define QUIRK_ENUM(profile, name, shift_vy, increment_i, reset_vf, wrap) QUIRKS_##profile,
+    QUIRK_PROFILES(QUIRK_ENUM)
+#undef QUIRK_ENUM
+    QUIRK_PROFILE_COUNT
+} quirk_profiles;
+
+//Opcode groups the profiler counts separately, see profile.c
+typedef enum{
+    CLASS_00E0, CLASS_00EE, CLASS_0NNN, CLASS_1NNN, CLASS_2NNN, CLASS_3XNN,
+    CLASS_4XNN, CLASS_5XY0, CLASS_6XNN, CLASS_7XNN, CLASS_8XY0, CLASS_8XY1,
+    CLASS_8XY2, CLASS_8XY3, CLASS_8XY4, CLASS_8XY5, CLASS_8XY6, CLASS_8XY7,
+    CLASS_8XYE, CLASS_9XY0, CLASS_ANNN, CLASS_BNNN, CLASS_CXNN, CLASS_DXYN,
+    CLASS_EX9E, CLASS_EXA1, CLASS_FX07, CLASS_FX0A, CLASS_FX15, CLASS_FX18,
+    CLASS_FX1E, CLASS_FX29, CLASS_FX33, CLASS_FX55, CLASS_FX65, CLASS_00CN,
+    CLASS_00DN, CLASS_00FB, CLASS_00FC, CLASS_00FD, CLASS_00FE, CLASS_00FF, CLASS_FX30,
+    CLASS_FX75, CLASS_FX85, CLASS_F000, CLASS_FN01, CLASS_F002, CLASS_FX3A,
+    CLASS_5XY2, CLASS_5XY3, CLASS_OTHER,
+    OPCODE_CLASSES
+} opcode_classes;
+
+struct chip8;
+struct block_cache;
+struct jit_cache;
+struct trace_buffer;
+struct aot_program;
+struct aot_cache;
+
+//Execution counters, allocated only while profiling
+typedef struct profile{
+    __uint64_t class_counts[OPCODE_CLASSES]; //Instructions executed per opcode class
+    __uint64_t address_counts[RAM_SIZE]; //Instructions executed per address
+    __uint64_t collisions; //Dxyn that turned a pixel off
+    __uint64_t key_wait_spins; //Fx0A executions that kept waiting
+    __uint64_t idle_skipped; //Instructions of delay timer spin loops skipped rather than run, included in the counts above
+} profile;
+
+//An opcode decoded once: the function that executes it plus its pre-extracted operands
+typedef struct instruction{
+    void (*handler)(struct chip8 *chip8_object_ptr, const struct instruction *ins); //NULL = not decoded yet
+    __uint16_t opcode; //The raw 16-bit opcode
+    __uint16_t nnn; //Lowest 12 bits, an address
+    __uint8_t nn; //Lowest 8 bits, a constant
+    __uint8_t n; //Lowest 4 bits
+    __uint8_t x; //Second nibble, a register number
+    __uint8_t y; //Third nibble, a register number
+    __uint8_t opclass; //opcode_classes value, for the profiler
+} instruction;
+
+typedef struct chip8{
+    __uint8_t RAM[RAM_SIZE]; //Stores data regarding the program
+    __uint64_t display[DISPLAY_PLANES][DISPLAY_HEIGHT][DISPLAY_WORDS]; //Stores the value of pixels that will be displayed, one bit per pixel and plane
+    __uint8_t hires; //SUPER-CHIP 128x64 mode, the whole display is used instead of the top left 64x32
+    __uint8_t planes; //Bitmask of the planes drawing, clearing and scrolling act on (XO-CHIP Fn01), 1 by default
+    __uint8_t display_dirty; //Set when display changed since the frontend last drew it
+    __uint8_t dirty_first_row; //Range of rows changed since the last draw, valid while display_dirty is set
+    __uint8_t dirty_last_row;
+    __uint16_t PC; //Points at current instruction in memory(RAM)
+    __uint16_t I; //Points at locations in memory(RAM)
+    __uint16_t stack[STACK_SIZE]; //Stores 16-bit addresses which is used to call subroutines/functions and return from them  
+    __uint8_t sp; //Stores the index value which pointes to the top  of the stack 
+    __uint8_t registers[16]; //General-purpose variable registers 
+    __uint8_t rpl[RPL_FLAGS]; //SUPER-CHIP flag registers, Fx75/Fx85
+    __uint8_t delay_timer; //Delay timer which is decremented at a rate of 60 Hz until it reaches 0
+    __uint8_t sound_timer; //Sound timer which functions like the delay timer, but which also gives off a beeping sound as long as it’s not 0
+    __uint8_t audio_pattern[AUDIO_PATTERN_SIZE]; //XO-CHIP sample pattern loaded by F002
+    __uint8_t audio_pattern_loaded; //F002 ran, the beeper plays the pattern instead of the plain tone
+    __uint8_t pitch; //XO-CHIP playback rate of the pattern, Fx3A
+    __uint16_t keys; //Keypad, bit i is set while key i is held
+    __uint8_t key_waiting; //Fx0A saw a key go down and is waiting for it to be released
+    __uint8_t waited_key; //The key Fx0A is waiting on, valid while key_waiting is set
+    __uint32_t rng_state; //State of the Cxkk random number generator, never 0
+    __uint32_t rom_size; //Bytes of ROM initialize_chip8() loaded at PROGRAM_START
+    states state; //The state of the emulator Running/Not-Running
+    __uint64_t frames; //Timer ticks since the machine was initialised
+    __uint8_t beeping; //The sound timer was running during the last frame
+    engines engine; //Which execution engine execute_instructions() uses
+    __uint8_t skip_idle; //Engines may skip the rest of a frame spent in a delay timer spin loop, see skip_idle_loop()
+    quirk_profiles quirks; //Which decode tables decode_instruction() uses, see set_quirks()
+    instruction decoded[RAM_SIZE]; //Decoded instruction cache indexed by RAM address, cleared when RAM is written
+    __uint8_t written_pages[CODE_PAGES / 8]; //Bit per CODE_PAGE_SIZE bytes of RAM written since the block engine last checked
+    __uint8_t pages_written; //Set when any bit in written_pages is set
+    __uint16_t first_written_page, last_written_page; //Pages holding every set bit, valid while pages_written
+    struct block_cache *blocks; //Translated blocks, NULL unless the block engine is used
+    struct jit_cache *jit; //Compiled blocks, NULL unless the JIT is used
+    profile *profile; //Execution counters, NULL unless profiling
+    struct trace_buffer *trace; //Binary trace being recorded, NULL unless tracing
+    const struct aot_program *aot_program; //Compiled ROM the AOT engine runs, NULL if none was linked in
+    struct aot_cache *aot; //Lookup table for aot_program, NULL unless the AOT engine is used
+} chip8;
+
+typedef void (*handler_fn)(chip8 *chip8_object_ptr, const instruction *ins);
+
+//A basic block chip8-aot compiled, code runs all length instructions
+typedef struct aot_block{
+    __uint16_t start; //Address of the first instruction
+    __uint8_t length; //Number of instructions
+    const instruction *ops; //The decoded instructions, for the profiler
+    void (*code)(chip8 *chip8_object_ptr);
+} aot_block;
+
+//Everything chip8-aot generates for one ROM
+typedef struct aot_program{
+    const char *name; //ROM file it was generated from
+    const __uint8_t *rom; //The ROM, the program only runs on a machine that loaded exactly this
+    size_t rom_size;
+    const aot_block *blocks;
+    size_t block_count;
+    quirk_profiles quirks; //Profile the ROM was compiled for, the handlers are baked into the blocks
+} aot_program;
+
+//Every handler decode_instruction() can pick, the index is how chip8-aot and the ROM cache refer to one
+typedef struct handler_name{
+    handler_fn handler;
+    const char *name;
+} handler_name;
+
+#define ROM_CACHE_VERSION 2
+
+//Start of a ROM cache file, see romcache.c
+typedef struct rom_cache_header{
+    char magic[4]; //"C8RC"
+    __uint32_t version; //ROM_CACHE_VERSION
+    __uint64_t handler_hash; //handler_table_hash() of the build that wrote it
+    __uint64_t rom_hash; //hash_bytes() of the ROM, also the file name
+    __uint32_t rom_size; //The ROM follows the header, then instruction_count cached_instructions
+    __uint32_t instruction_count;
+    __uint32_t quirks; //Profile the instructions were decoded for
+    __uint32_t reserved;
+} rom_cache_header;
+
+//An instruction reachable from PROGRAM_START, decoded
+typedef struct cached_instruction{
+    __uint16_t address;
+    __uint16_t opcode;
+    __uint16_t nnn;
+    __uint8_t nn;
+    __uint8_t n;
+    __uint8_t x;
+    __uint8_t y;
+    __uint8_t opclass;
+    __uint8_t handler; //Index into handler_names
+} cached_instruction;
+
+//Everything a ROM can observe, what savestates and the rewind buffer store, see savestate.c
+typedef struct machine_state{
+    __uint8_t RAM[RAM_SIZE];
+    __uint64_t display[DISPLAY_PLANES][DISPLAY_HEIGHT][DISPLAY_WORDS];
+    __uint8_t hires;
+    __uint8_t planes;
+    __uint16_t PC;
+    __uint16_t I;
+    __uint16_t stack[STACK_SIZE];
+    __uint8_t sp;
+    __uint8_t registers[16];
+    __uint8_t rpl[RPL_FLAGS];
+    __uint8_t delay_timer;
+    __uint8_t sound_timer;
+    __uint8_t audio_pattern[AUDIO_PATTERN_SIZE];
+    __uint8_t audio_pattern_loaded;
+    __uint8_t pitch;
+    __uint8_t key_waiting;
+    __uint8_t waited_key;
+    __uint32_t rng_state;
+    __uint64_t frames;
+} machine_state;
+
+typedef struct rewind_buffer rewind_buffer;
+
+#define TRACE_VERSION 1
+
+//Start of a trace file, see trace.c
+typedef struct trace_header{
+    char magic[4]; //"C8TR"
+    __uint32_t version;
+    __uint32_t record_size; //sizeof(trace_record)
+    __uint32_t reserved;
+    __uint64_t capacity; //Records in the ring
+    __uint64_t head; //Records written so far, the newest one is at (head - 1) % capacity
+} trace_header;
+
+//One executed instruction and the state just before it ran
+typedef struct trace_record{
+    __uint16_t pc;
+    __uint16_t opcode;
+    __uint16_t I;
+    __uint16_t stack_top; //stack[sp], 0 while the stack is empty
+    __uint8_t registers[16];
+} trace_record;
+
+typedef struct trace_buffer trace_buffer;
+
+//An input movie being recorded or played back, see movie.c
+typedef struct movie{
+    FILE *file; //NULL when no movie is open
+    int recording; //1 = key changes are written, 0 = they are read back
+    __uint32_t seed; //Seed of the random number generator for the whole run
+    __uint32_t ips; //Instructions per second the movie was recorded at
+    quirk_profiles quirks; //Quirk profile the movie was recorded with
+    __uint16_t keys; //Key state last written/applied, bit i = key i
+    __uint64_t frame; //Recording: frame of the last record written
+    __uint64_t next_frame; //Playback: frame the next record applies at
+    __uint16_t next_keys; //Playback: key state of the next record
+    int ended; //Playback: no key changes left
+    __uint64_t end_frame; //Playback: frame the recording stopped at, valid once ended is set
+} movie;
+
+//Output formats of --capture, see capture.c
+typedef enum{
+    CAPTURE_RAW, //RGB24 frames back to back
+    CAPTURE_Y4M, //YUV4MPEG2 4:4:4
+    CAPTURE_PNG, //One indexed PNG per frame
+} capture_formats;
+
+//What capture_frame() does when the writer thread is behind
+typedef enum{
+    CAPTURE_BLOCK, //Wait for a free slot, no frame is lost
+    CAPTURE_DROP, //Discard the frame and count it
+} capture_policies;
+
+typedef struct capture capture;
+
+#define SHARED_VERSION 1
+
+//Slots in the command ring of a shared segment, a power of two
+#define SHARED_COMMANDS 64
+
+//Machine state published once per frame through a shared segment, see shared.c
+typedef struct shared_frame{
+    __uint64_t frame; //chip8->frames when this was published
+    __uint64_t display[DISPLAY_PLANES][DISPLAY_HEIGHT][DISPLAY_WORDS]; //Same layout as chip8->display
+    __uint16_t PC;
+    __uint16_t I;
+    __uint16_t stack[STACK_SIZE];
+    __uint16_t keys; //Bit i is set while key i is held
+    __uint8_t sp;
+    __uint8_t registers[16];
+    __uint8_t delay_timer;
+    __uint8_t sound_timer;
+    __uint8_t hires;
+    __uint8_t planes;
+    __uint8_t running; //0 once the emulator has stopped, nothing is published after that
+} shared_frame;
+
+typedef enum{
+    SHARED_KEY_DOWN = 1,
+    SHARED_KEY_UP,
+    SHARED_QUIT,
+} shared_commands;
+
+//Input sent to the emulator through the command ring
+typedef struct shared_command{
+    __uint8_t type; //shared_commands value
+    __uint8_t key; //Keypad key 0-F, for SHARED_KEY_DOWN/SHARED_KEY_UP
+} shared_command;
+
+/*
+POSIX shared memory segment exported with --export. The emulator is the
+only writer of sequence and frame, one other process at a time may send
+commands. Counters on separate cache lines so the two sides don't bounce
+a line on every access.
+*/
+typedef struct shared_segment{
+    char magic[4]; //"C8SM"
+    __uint32_t version;
+    __uint32_t size; //sizeof(shared_segment)
+    __uint32_t reserved;
+    __uint64_t sequence; //Seqlock over frame: odd while the emulator is writing it
+    char pad0[40];
+    shared_frame frame;
+    char pad1[64];
+    __uint32_t command_head; //Commands sent so far, written by the sender
+    char pad2[60];
+    __uint32_t command_tail; //Commands applied so far, written by the emulator
+    char pad3[60];
+    shared_command commands[SHARED_COMMANDS]; //Command n is in commands[n % SHARED_COMMANDS]
+} shared_segment;
+
+typedef struct shared_export shared_export;
+
+//core.c
+void initialize_chip8(chip8 *chip8_object_ptr, FILE *rom);
+void destroy_chip8(chip8 *chip8_object_ptr);
+void set_engine(chip8 *chip8_object_ptr, engines engine);
+void set_quirks(chip8 *chip8_object_ptr, quirk_profiles quirks);
+int quirk_profile_from_name(const char *name);
+const char *quirk_profile_name(quirk_profiles quirks);
+void seed_chip8(chip8 *chip8_object_ptr, __uint32_t seed);
+void set_key(chip8 *chip8_object_ptr, __uint8_t key, int down);
+int blocked_on_key(chip8 *chip8_object_ptr);
+
+void set_register_value(chip8 *chip8_object_ptr, const instruction *ins);
+void add_register_value(chip8 *chip8_object_ptr, const instruction *ins);
+void clear_screen(chip8 *chip8_object_ptr, const instruction *ins);
+void set_pc(chip8 *chip8_object_ptr, const instruction *ins);
+void set_i(chip8 *chip8_object_ptr, const instruction *ins);
+void display_fun(chip8 *chip8_object_ptr, const instruction *ins);
+void display_fun_wrap(chip8 *chip8_object_ptr, const instruction *ins);
+void display_to_bytes(const chip8 *chip8_object_ptr, __uint8_t *pixels);
+void mark_display_dirty(chip8 *chip8_object_ptr, __uint8_t first_row, __uint8_t last_row);
+void call_subroutine(chip8 *chip8_object_ptr, const instruction *ins);
+void return_from_subroutine(chip8 *chip8_object_ptr, const instruction *ins);
+void skip_constant_equal(chip8 *chip8_object_ptr, const instruction *ins);
+void skip_not_constant_equal(chip8 *chip8_object_ptr, const instruction *ins);
+void skip_register_equal(chip8 *chip8_object_ptr, const instruction *ins);
+void skip_register_not_equal(chip8 *chip8_object_ptr, const instruction *ins);
+void jump_with_offset(chip8 *chip8_object_ptr, const instruction *ins);
+void random_number(chip8 *chip8_object_ptr, const instruction *ins);
+void set_vx_vy(chip8 *chip8_object_ptr, const instruction *ins);
+void binary_or(chip8 *chip8_object_ptr, const instruction *ins);
+void binary_and(chip8 *chip8_object_ptr, const instruction *ins);
+void binary_xor(chip8 *chip8_object_ptr, const instruction *ins);
+void binary_or_reset_vf(chip8 *chip8_object_ptr, const instruction *ins);
+void binary_and_reset_vf(chip8 *chip8_object_ptr, const instruction *ins);
+void binary_xor_reset_vf(chip8 *chip8_object_ptr, const instruction *ins);
+void subtract_vx_vy(chip8 *chip8_object_ptr, const instruction *ins);
+void subtract_vy_vx(chip8 *chip8_object_ptr, const instruction *ins);
+void add(chip8 *chip8_object_ptr, const instruction *ins);
+void shift_right(chip8 *chip8_object_ptr, const instruction *ins);
+void shift_left(chip8 *chip8_object_ptr, const instruction *ins);
+void shift_right_vx(chip8 *chip8_object_ptr, const instruction *ins);
+void shift_left_vx(chip8 *chip8_object_ptr, const instruction *ins);
+void store_memory(chip8 *chip8_object_ptr, const instruction *ins);
+void load_memory(chip8 *chip8_object_ptr, const instruction *ins);
+void store_memory_increment(chip8 *chip8_object_ptr, const instruction *ins);
+void load_memory_increment(chip8 *chip8_object_ptr, const instruction *ins);
+void add_to_index(chip8 *chip8_object_ptr, const instruction *ins);
+void decimal_conversion(chip8 *chip8_object_ptr, const instruction *ins);
+void font_char(chip8 *chip8_object_ptr, const instruction *ins);
+void set_vx_delaytimer(chip8 *chip8_object_ptr, const instruction *ins);
+void set_delaytimer_vx(chip8 *chip8_object_ptr, const instruction *ins);
+void set_soundtimer_vx(chip8 *chip8_object_ptr, const instruction *ins);
+void get_key(chip8 *chip8_object_ptr, const instruction *ins);
+void skip_if_key(chip8 *chip8_object_ptr, const instruction *ins);
+void skip_if_not_key(chip8 *chip8_object_ptr, const instruction *ins);
+void unimplemented(chip8 *chip8_object_ptr, const instruction *ins);
+void no_operation(chip8 *chip8_object_ptr, const instruction *ins);
+void scroll_down(chip8 *chip8_object_ptr, const instruction *ins);
+void scroll_up(chip8 *chip8_object_ptr, const instruction *ins);
+void scroll_right(chip8 *chip8_object_ptr, const instruction *ins);
+void scroll_left(chip8 *chip8_object_ptr, const instruction *ins);
+void exit_interpreter(chip8 *chip8_object_ptr, const instruction *ins);
+void low_resolution(chip8 *chip8_object_ptr, const instruction *ins);
+void high_resolution(chip8 *chip8_object_ptr, const instruction *ins);
+void big_font_char(chip8 *chip8_object_ptr, const instruction *ins);
+void save_flags(chip8 *chip8_object_ptr, const instruction *ins);
+void load_flags(chip8 *chip8_object_ptr, const instruction *ins);
+void long_index(chip8 *chip8_object_ptr, const instruction *ins);
+__uint16_t skip_length(const chip8 *chip8_object_ptr);
+void select_planes(chip8 *chip8_object_ptr, const instruction *ins);
+void save_range(chip8 *chip8_object_ptr, const instruction *ins);
+void load_range(chip8 *chip8_object_ptr, const instruction *ins);
+void load_audio_pattern(chip8 *chip8_object_ptr, const instruction *ins);
+void set_pitch(chip8 *chip8_object_ptr, const instruction *ins);
+
+void ram_written(chip8 *chip8_object_ptr, __uint16_t address, __uint16_t len);
+void clear_written_pages(chip8 *chip8_object_ptr);
+const instruction *decode_instruction(chip8 *chip8_object_ptr, __uint16_t address);
+void execute_instruction(chip8 *chip8_object_ptr);
+long execute_instructions(chip8 *chip8_object_ptr, long count);
+long skip_idle_loop(chip8 *chip8_object_ptr, long count);
+
+//Cheap test the engines make before calling skip_idle_loop(), every loop it skips starts with Fx07;
+//  it reads the opcode from RAM since compiled AOT blocks never fill chip8->decoded
+#define IDLE_LOOP_CANDIDATE(chip8_object_ptr) \
+    (((chip8_object_ptr)->RAM[(chip8_object_ptr)->PC & (RAM_SIZE - 1)] & 0xF0) == 0xF0 && \
+     (chip8_object_ptr)->RAM[((chip8_object_ptr)->PC + 1) & (RAM_SIZE - 1)] == 0x07)
+void decrement_delay_timer(chip8 *chip8_obj_ptr);
+void decrement_sound_timer(chip8 *chip8_obj_ptr);
+long instructions_for_frame(const chip8 *chip8_object_ptr, long ips);
+void end_frame(chip8 *chip8_object_ptr);
+void run_frame(chip8 *chip8_object_ptr, long ips);
+void debug(chip8 *chip8_obj_ptr, __uint16_t ins);
+void print_instruction(FILE *out, __uint16_t pc, __uint16_t ins, const __uint8_t *registers, __uint16_t I, __uint16_t stack_top);
+
+extern const handler_name handler_names[];
+extern const size_t handler_count;
+
+//block.c
+void initialize_block_engine(chip8 *chip8_object_ptr);
+void destroy_block_engine(chip8 *chip8_object_ptr);
+long execute_blocks(chip8 *chip8_object_ptr, long count);
+int block_terminator(handler_fn handler);
+
+//jit.c
+int initialize_jit(chip8 *chip8_object_ptr);
+void destroy_jit(chip8 *chip8_object_ptr);
+long execute_jit(chip8 *chip8_object_ptr, long count);
+
+//aot.c
+int initialize_aot(chip8 *chip8_object_ptr);
+void destroy_aot(chip8 *chip8_object_ptr);
+long execute_aot(chip8 *chip8_object_ptr, long count);
+
+//Defined in the file chip8-aot generates, only linked into chip8-native (make native)
+extern const aot_program aot_builtin_program;
+
+//romcache.c
+__uint64_t hash_bytes(__uint64_t hash, const void *data, size_t len);
+int handler_index(handler_fn handler);
+int instruction_successors(chip8 *chip8_object_ptr, int address, int *next);
+int load_rom_cache(chip8 *chip8_object_ptr, const char *directory);
+
+//profile.c
+opcode_classes opcode_class(__uint16_t ins);
+void enable_profile(chip8 *chip8_object_ptr);
+void destroy_profile(chip8 *chip8_object_ptr);
+void profile_block(profile *profile_ptr, const instruction *ops, __uint16_t start, long count);
+void print_profile(FILE *out, const chip8 *chip8_object_ptr);
+
+//trace.c
+void start_trace(chip8 *chip8_object_ptr, const char *path, __uint64_t records);
+void stop_trace(chip8 *chip8_object_ptr);
+void trace_instruction(trace_buffer *trace, const chip8 *chip8_object_ptr, __uint16_t pc, __uint16_t opcode);
+
+//movie.c
+void start_recording(movie *movie_ptr, const char *path, __uint32_t seed, long ips, quirk_profiles quirks);
+void start_playback(movie *movie_ptr, const char *path);
+void movie_frame(movie *movie_ptr, chip8 *chip8_object_ptr);
+int movie_finished(const movie *movie_ptr, const chip8 *chip8_object_ptr);
+void stop_movie(movie *movie_ptr, const chip8 *chip8_object_ptr);
+
+//savestate.c
+void save_state(const chip8 *chip8_object_ptr, machine_state *state);
+void load_state(chip8 *chip8_object_ptr, const machine_state *state);
+int write_state_file(const chip8 *chip8_object_ptr, const char *path);
+int read_state_file(chip8 *chip8_object_ptr, const char *path);
+rewind_buffer *create_rewind_buffer(long seconds, size_t budget);
+void destroy_rewind_buffer(rewind_buffer *buffer);
+void rewind_push(rewind_buffer *buffer, const chip8 *chip8_object_ptr);
+int rewind_step(rewind_buffer *buffer, chip8 *chip8_object_ptr);
+size_t rewind_memory_used(rewind_buffer *buffer);
+size_t rewind_frames(const rewind_buffer *buffer);
+
+//capture.c
+capture *start_capture(const char *path, capture_formats format, int scale, capture_policies policy, const __uint32_t palette[4]);
+void capture_frame(capture *capture_ptr, const chip8 *chip8_object_ptr);
+void stop_capture(capture *capture_ptr);
+
+//shared.c
+shared_export *start_export(const char *name);
+void export_frame(shared_export *export_ptr, const chip8 *chip8_object_ptr);
+void export_commands(shared_export *export_ptr, chip8 *chip8_object_ptr);
+void stop_export(shared_export *export_ptr, const chip8 *chip8_object_ptr);
+shared_segment *open_shared(const char *name);
+void close_shared(shared_segment *segment);
+__uint64_t shared_read_begin(const shared_segment *segment);
+int shared_read_retry(const shared_segment *segment, __uint64_t sequence);
+void read_shared_frame(const shared_segment *segment, shared_frame *frame);
+int send_shared_command(shared_segment *segment, shared_commands type, __uint8_t key);
+
+#endif
@@ -0,0 +1,1354 @@
+#include <stdlib.h>
+#include <string.h>
+#include "chip8.h"
+
+void initialize_chip8(chip8 *chip8_object_ptr, FILE *rom){
+    
+    //Start from a known state so registers, timers and the stack are deterministic
+    memset(chip8_object_ptr, 0, sizeof *chip8_object_ptr);
+
+    //The font represents the hexidacimal number 0-F
+    char fonts[] = {
+        0xF0, 0x90, 0x90, 0x90, 0xF0, // 0 
+        0x20, 0x60, 0x20, 0x20, 0x70, // 1
+        0xF0, 0x10, 0xF0, 0x80, 0xF0, // 2
+        0xF0, 0x10, 0xF0, 0x10, 0xF0, // 3
+        0x90, 0x90, 0xF0, 0x10, 0x10, // 4
+        0xF0, 0x80, 0xF0, 0x10, 0xF0, // 5
+        0xF0, 0x80, 0xF0, 0x90, 0xF0, // 6
+        0xF0, 0x10, 0x20, 0x40, 0x40, // 7
+        0xF0, 0x90, 0xF0, 0x90, 0xF0, // 8
+        0xF0, 0x90, 0xF0, 0x10, 0xF0, // 9
+        0xF0, 0x90, 0xF0, 0x90, 0x90, // A
+        0xE0, 0x90, 0xE0, 0x90, 0xE0, // B
+        0xF0, 0x80, 0x80, 0x80, 0xF0, // C
+        0xE0, 0x90, 0x90, 0x90, 0xE0, // D
+        0xF0, 0x80, 0xF0, 0x80, 0xF0, // E
+        0xF0, 0x80, 0xF0, 0x80, 0x80  // F
+    };
+
+    //SUPER-CHIP's 8x10 font, digits 0-9 plus the A-F most interpreters add
+    char big_fonts[] = {
+        0x3C, 0x7E, 0xE7, 0xC3, 0xC3, 0xC3, 0xC3, 0xE7, 0x7E, 0x3C, // 0
+        0x18, 0x38, 0x58, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x3C, // 1
+        0x3E, 0x7F, 0xC3, 0x06, 0x0C, 0x18, 0x30, 0x60, 0xFF, 0xFF, // 2
+        0x3C, 0x7E, 0xC3, 0x03, 0x0E, 0x0E, 0x03, 0xC3, 0x7E, 0x3C, // 3
+        0x06, 0x0E, 0x1E, 0x36, 0x66, 0xC6, 0xFF, 0xFF, 0x06, 0x06, // 4
+        0xFF, 0xFF, 0xC0, 0xC0, 0xFC, 0xFE, 0x03, 0xC3, 0x7E, 0x3C, // 5
+        0x3E, 0x7C, 0xC0, 0xC0, 0xFC, 0xFE, 0xC3, 0xC3, 0x7E, 0x3C, // 6
+        0xFF, 0xFF, 0x03, 0x06, 0x0C, 0x18, 0x30, 0x60, 0x60, 0x60, // 7
+        0x3C, 0x7E, 0xC3, 0xC3, 0x7E, 0x7E, 0xC3, 0xC3, 0x7E, 0x3C, // 8
+        0x3C, 0x7E, 0xC3, 0xC3, 0x7F, 0x3F, 0x03, 0x03, 0x3E, 0x7C, // 9
+        0x7E, 0xFF, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xC3, // A
+        0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC, // B
+        0x3C, 0xFF, 0xC3, 0xC0, 0xC0, 0xC0, 0xC0, 0xC3, 0xFF, 0x3C, // C
+        0xFC, 0xFE, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFE, 0xFC, // D
+        0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, // E
+        0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xC0, 0xC0  // F
+    };
+
+    //Load fonts into chip8 memory
+    memcpy(chip8_object_ptr->RAM + FONT_ADDRESS, fonts, sizeof(fonts));  
+    memcpy(chip8_object_ptr->RAM + BIG_FONT_ADDRESS, big_fonts, sizeof(big_fonts));
+
+    //Load ROM data into chip8 memory, anything past the end of the address space is an error
+    chip8_object_ptr->rom_size = fread(chip8_object_ptr->RAM + PROGRAM_START, 1, MAX_ROM_SIZE, rom);
+    if(ferror(rom)){
+        printf("Error reading ROM\n");
+        exit(1);
+    }
+    if(fgetc(rom) != EOF){
+        printf("ROM too large, at most %d bytes fit\n", MAX_ROM_SIZE);
+        exit(1);
+    }
+    
+    //Set program counter to the start of the program
+    chip8_object_ptr->PC = PROGRAM_START;
+
+    //There is no stack yet
+    chip8_object_ptr->sp = -1;
+
+    //Set the state of the emulator to RUNNING
+    chip8_object_ptr->state = RUNNING;
+    chip8_object_ptr->skip_idle = 1;
+
+    //Deterministic until the caller picks a seed
+    seed_chip8(chip8_object_ptr, 1);
+
+    //Clear diplay 0 = black, CHIP-8 programs start in low resolution drawing on the first plane
+    memset(chip8_object_ptr->display, 0, sizeof chip8_object_ptr->display);
+    chip8_object_ptr->hires = 0;
+    chip8_object_ptr->planes = 1;
+
+    chip8_object_ptr->pitch = DEFAULT_PITCH;
+
+    //The blank screen still has to be shown once
+    mark_display_dirty(chip8_object_ptr, 0, LORES_HEIGHT - 1);
+    
+    //No key presses
+    chip8_object_ptr->keys = 0;
+}
+
+void set_key(chip8 *chip8_object_ptr, __uint8_t key, int down){
+    if(down){
+        chip8_object_ptr->keys |= 1 << (key & 0xf);
+    }else{
+        chip8_object_ptr->keys &= ~(1 << (key & 0xf));
+    }
+}
+
+void destroy_chip8(chip8 *chip8_object_ptr){
+    destroy_block_engine(chip8_object_ptr);
+    destroy_jit(chip8_object_ptr);
+    destroy_aot(chip8_object_ptr);
+    destroy_profile(chip8_object_ptr);
+    stop_trace(chip8_object_ptr);
+}
+
+void set_engine(chip8 *chip8_object_ptr, engines engine){
+    //Generated code has no per-instruction hook, traces are recorded by the block engine instead
+    if((engine == ENGINE_JIT || engine == ENGINE_AOT) && chip8_object_ptr->trace){
+        printf("%s can't record traces, using the block engine\n", (engine == ENGINE_JIT) ? "JIT" : "AOT code");
+        engine = ENGINE_BLOCK;
+    }
+
+    //The compiled program has to be linked in and match the loaded ROM
+    if(engine == ENGINE_AOT && !initialize_aot(chip8_object_ptr)){
+        printf("No AOT program for this ROM, using the interpreter\n");
+        engine = ENGINE_INTERPRETER;
+    }
+
+    //Hosts the JIT can't generate code for use the block engine instead
+    if(engine == ENGINE_JIT && !initialize_jit(chip8_object_ptr)){
+        printf("JIT not available on this host, using the block engine\n");
+        engine = ENGINE_BLOCK;
+    }
+    if(engine == ENGINE_BLOCK){
+        initialize_block_engine(chip8_object_ptr);
+    }
+    chip8_object_ptr->engine = engine;
+}
+
+//Call before set_engine() and load_rom_cache(), instructions decoded so far are decoded again with the new tables
+void set_quirks(chip8 *chip8_object_ptr, quirk_profiles quirks){
+    chip8_object_ptr->quirks = quirks;
+
+    for(int i=0; i<RAM_SIZE; i++){
+        chip8_object_ptr->decoded[i].handler = NULL;
+    }
+}
+
+static const char *const quirk_names[QUIRK_PROFILE_COUNT] = {
+#define QUIRK_NAME(profile, name, shift_vy, increment_i, reset_vf, wrap) [QUIRKS_##profile] = name,
+    QUIRK_PROFILES(QUIRK_NAME)
+#undef QUIRK_NAME
+};
+
+//-1 if there's no profile called name
+int quirk_profile_from_name(const char *name){
+    for(int i=0; i<QUIRK_PROFILE_COUNT; i++){
+        if(!strcmp(quirk_names[i], name)) return i;
+    }
+    return -1;
+}
+
+const char *quirk_profile_name(quirk_profiles quirks){
+    return (quirks < QUIRK_PROFILE_COUNT) ? quirk_names[quirks] : "unknown";
+}
+
+void set_register_value(chip8 *chip8_object_ptr, const instruction *ins){
+    //Calculate register number from opcode
+    __uint8_t reg_num = ins->x;
+            
+    //Calculate value from opcode
+    __uint8_t value = ins->nn;
+
+    //Assign value to register
+    chip8_object_ptr->registers[reg_num] = value; 
+}
+
+void add_register_value(chip8 *chip8_object_ptr, const instruction *ins){
+    //Calculate register number from opcode
+    __uint8_t reg_num = ins->x;
+            
+    //Calculate value from opcode
+    __uint8_t value = ins->nn;
+    
+    //Add value to register
+    chip8_object_ptr->registers[reg_num] += value; 
+}
+
+void mark_display_dirty(chip8 *chip8_object_ptr, __uint8_t first_row, __uint8_t last_row){
+    if(!chip8_object_ptr->display_dirty){
+        chip8_object_ptr->display_dirty = 1;
+        chip8_object_ptr->dirty_first_row = first_row;
+        chip8_object_ptr->dirty_last_row = last_row;
+        return;
+    }
+
+    if(first_row < chip8_object_ptr->dirty_first_row) chip8_object_ptr->dirty_first_row = first_row;
+    if(last_row > chip8_object_ptr->dirty_last_row) chip8_object_ptr->dirty_last_row = last_row;
+}
+
+void clear_screen(chip8 *chip8_object_ptr, const instruction *ins){
+    (void)ins;
+
+    //Only the selected planes
+    for(int plane=0; plane<DISPLAY_PLANES; plane++){
+        if(chip8_object_ptr->planes & (1 << plane)){
+            memset(chip8_object_ptr->display[plane], 0x0, sizeof chip8_object_ptr->display[plane]);
+        }
+    }
+    mark_display_dirty(chip8_object_ptr, 0, SCREEN_HEIGHT(chip8_object_ptr) - 1);
+}
+
+void set_pc(chip8 *chip8_object_ptr, const instruction *ins){
+    chip8_object_ptr->PC = ins->nnn;
+}
+
+void set_i(chip8 *chip8_object_ptr, const instruction *ins){
+    chip8_object_ptr->I = ins->nnn;
+}
+
+/*
+Handlers whose behaviour depends on the quirk profile are written once as
+a static inline body taking the quirk as a constant, and each profile's
+decode tables (see decode_instruction()) point at the variant built with
+its value. The branch on the quirk is folded away when the variant is
+compiled, so choosing a profile costs nothing per instruction.
+*/
+static inline void draw_sprite(chip8 *chip8_object_ptr, const instruction *ins, const int wrap){
+    // 0xDXYN: Draw N-height sprite at coords X,Y; Read from memory location I;
+    //   Screen pixels are XOR'd with sprite bits, 
+    //   VF (Carry flag) is set if any screen pixels are set off; This is useful
+    //   for collision detection or other reasons.
+    // 0xDXY0 draws a 16x16 sprite, two bytes per row (SUPER-CHIP)
+    // With both planes selected the sprite for the second plane follows the first one in memory (XO-CHIP)
+    const int width = SCREEN_WIDTH(chip8_object_ptr);
+    const int height = SCREEN_HEIGHT(chip8_object_ptr);
+    uint8_t X = chip8_object_ptr->registers[ins->x] & (width - 1);
+    uint8_t Y = chip8_object_ptr->registers[ins->y] & (height - 1);
+    uint8_t sprite_width = ins->n ? 8 : 16;
+    uint8_t n = ins->n ? ins->n : 16;
+    uint8_t clipped = 0;
+    const __uint16_t plane_bytes = n * (sprite_width / 8);
+
+    // Sprite rows falling off the bottom edge are not drawn, unless they wrap around to the top
+    if (!wrap && n > height - Y){
+        clipped = n - (height - Y);
+        n = height - Y;
+    }
+
+    // The right word only exists in high resolution, in low resolution bits spilling into it are dropped
+    const __uint64_t right_mask = chip8_object_ptr->hires ? ~(__uint64_t)0 : 0;
+    uint8_t collided_rows = 0;
+
+    for (uint8_t i = 0; i < n; i++) {
+        __uint16_t address = chip8_object_ptr->I + i * (sprite_width / 8);
+        __uint64_t collision = 0;
+
+        for (int plane = 0; plane < DISPLAY_PLANES; plane++) {
+            if (!(chip8_object_ptr->planes & (1 << plane))) continue;
+
+            __uint64_t sprite_row = chip8_object_ptr->RAM[address & (RAM_SIZE - 1)];
+
+            if (sprite_width == 16) {
+                sprite_row = (sprite_row << 8) | chip8_object_ptr->RAM[(address + 1) & (RAM_SIZE - 1)];
+            }
+            address += plane_bytes;
+
+            // Move the sprite to the top of a word, then to column X across the row's two words;
+            //   bits pushed past the right edge of the screen are dropped
+            sprite_row <<= 64 - sprite_width;
+
+            __uint64_t left, right;
+            if (X < 64) {
+                left = sprite_row >> X;
+                right = X ? sprite_row << (64 - X) : 0;
+            } else {
+                left = 0;
+                right = sprite_row >> (X - 64);
+            }
+
+            // Wrapping, bits past the right edge come back in at column 0: 64 columns in low resolution, 128 in high
+            if (wrap && !chip8_object_ptr->hires) {
+                left |= X ? sprite_row << (64 - X) : 0;
+            } else if (wrap && X > 64) {
+                left = sprite_row << (128 - X);
+            }
+            right &= right_mask;
+
+            __uint64_t *row = chip8_object_ptr->display[plane][wrap ? (Y + i) & (height - 1) : Y + i];
+            collision |= (row[0] & left) | (row[1] & right);
+            row[0] ^= left;
+            row[1] ^= right;
+        }
+
+        collided_rows += (collision != 0);
+    }
+
+    // SUPER-CHIP counts the rows that collided or fell off the bottom in high resolution
+    chip8_object_ptr->registers[0xF] = chip8_object_ptr->hires ? collided_rows + clipped : (collided_rows != 0);
+
+    if (collided_rows && chip8_object_ptr->profile) chip8_object_ptr->profile->collisions++;
+
+    if (wrap && n > height - Y) {
+        mark_display_dirty(chip8_object_ptr, 0, height - 1);
+    } else if (n > 0) {
+        mark_display_dirty(chip8_object_ptr, Y, Y + n - 1);
+    }
+}
+
+void display_fun(chip8 *chip8_object_ptr, const instruction *ins){
+    draw_sprite(chip8_object_ptr, ins, 0);
+}
+
+//XO-CHIP wraps sprites around the screen edges instead of clipping them
+void display_fun_wrap(chip8 *chip8_object_ptr, const instruction *ins){
+    draw_sprite(chip8_object_ptr, ins, 1);
+}
+
+void display_to_bytes(const chip8 *chip8_object_ptr, __uint8_t *pixels){
+    const int width = SCREEN_WIDTH(chip8_object_ptr);
+
+    //One byte per pixel, row by row, the colour 0-3, at the current resolution
+    for(int y=0; y<SCREEN_HEIGHT(chip8_object_ptr); y++){
+        for(int x=0; x<width; x++){
+            pixels[y * width + x] = PIXEL(chip8_object_ptr, x, y);
+        }
+    }
+}
+
+//Scrolls move the selected planes only
+void scroll_down(chip8 *chip8_object_ptr, const instruction *ins){
+    //0x00CN, N rows of the current resolution; whole rows move, the ones scrolled in are blank
+    const int height = SCREEN_HEIGHT(chip8_object_ptr);
+    int n = ins->n;
+
+    if(n > height) n = height;
+
+    for(int plane=0; plane<DISPLAY_PLANES; plane++){
+        __uint64_t (*rows)[DISPLAY_WORDS] = chip8_object_ptr->display[plane];
+
+        if(!(chip8_object_ptr->planes & (1 << plane))) continue;
+
+        memmove(rows[n], rows[0], (height - n) * sizeof rows[0]);
+        memset(rows[0], 0, n * sizeof rows[0]);
+    }
+
+    mark_display_dirty(chip8_object_ptr, 0, height - 1);
+}
+
+void scroll_up(chip8 *chip8_object_ptr, const instruction *ins){
+    //0x00DN (XO-CHIP)
+    const int height = SCREEN_HEIGHT(chip8_object_ptr);
+    int n = ins->n;
+
+    if(n > height) n = height;
+
+    for(int plane=0; plane<DISPLAY_PLANES; plane++){
+        __uint64_t (*rows)[DISPLAY_WORDS] = chip8_object_ptr->display[plane];
+
+        if(!(chip8_object_ptr->planes & (1 << plane))) continue;
+
+        memmove(rows[0], rows[n], (height - n) * sizeof rows[0]);
+        memset(rows[height - n], 0, n * sizeof rows[0]);
+    }
+
+    mark_display_dirty(chip8_object_ptr, 0, height - 1);
+}
+
+void scroll_right(chip8 *chip8_object_ptr, const instruction *ins){
+    //0x00FB, 4 pixels; each row shifts as a pair of words, the left word's low bits carry into the right one
+    const __uint64_t right_mask = chip8_object_ptr->hires ? ~(__uint64_t)0 : 0;
+    (void)ins;
+
+    for(int plane=0; plane<DISPLAY_PLANES; plane++){
+        if(!(chip8_object_ptr->planes & (1 << plane))) continue;
+
+        for(int y=0; y<SCREEN_HEIGHT(chip8_object_ptr); y++){
+            __uint64_t *row = chip8_object_ptr->display[plane][y];
+
+            row[1] = ((row[1] >> 4) | (row[0] << 60)) & right_mask;
+            row[0] >>= 4;
+        }
+    }
+
+    mark_display_dirty(chip8_object_ptr, 0, SCREEN_HEIGHT(chip8_object_ptr) - 1);
+}
+
+void scroll_left(chip8 *chip8_object_ptr, const instruction *ins){
+    //0x00FC, 4 pixels; in low resolution the right word is always blank, so nothing comes in from it
+    (void)ins;
+
+    for(int plane=0; plane<DISPLAY_PLANES; plane++){
+        if(!(chip8_object_ptr->planes & (1 << plane))) continue;
+
+        for(int y=0; y<SCREEN_HEIGHT(chip8_object_ptr); y++){
+            __uint64_t *row = chip8_object_ptr->display[plane][y];
+
+            row[0] = (row[0] << 4) | (row[1] >> 60);
+            row[1] <<= 4;
+        }
+    }
+
+    mark_display_dirty(chip8_object_ptr, 0, SCREEN_HEIGHT(chip8_object_ptr) - 1);
+}
+
+void exit_interpreter(chip8 *chip8_object_ptr, const instruction *ins){
+    (void)ins;
+    chip8_object_ptr->state = NOT_RUNNING;
+}
+
+//Switching resolution clears every plane, like SUPER-CHIP 1.1 and later interpreters do
+void low_resolution(chip8 *chip8_object_ptr, const instruction *ins){
+    (void)ins;
+    chip8_object_ptr->hires = 0;
+    memset(chip8_object_ptr->display, 0, sizeof chip8_object_ptr->display);
+    mark_display_dirty(chip8_object_ptr, 0, LORES_HEIGHT - 1);
+}
+
+void high_resolution(chip8 *chip8_object_ptr, const instruction *ins){
+    (void)ins;
+    chip8_object_ptr->hires = 1;
+    memset(chip8_object_ptr->display, 0, sizeof chip8_object_ptr->display);
+    mark_display_dirty(chip8_object_ptr, 0, DISPLAY_HEIGHT - 1);
+}
+
+void select_planes(chip8 *chip8_object_ptr, const instruction *ins){
+    //0xFN01, N is the plane mask
+    chip8_object_ptr->planes = ins->x & ((1 << DISPLAY_PLANES) - 1);
+}
+
+void call_subroutine(chip8 *chip8_object_ptr, const instruction *ins){
+    //A full stack would overwrite the rest of the machine, stop instead
+    if((__uint8_t)(chip8_object_ptr->sp + 1) >= STACK_SIZE){
+        printf("Stack overflow at 0x%03X\n", chip8_object_ptr->PC - 2);
+        chip8_object_ptr->state = NOT_RUNNING;
+        return;
+    }
+
+    //Update stack pointer
+    chip8_object_ptr->sp++;
+    
+    //Store the next instruction address on the stack, PC already points at it
+    chip8_object_ptr->stack[chip8_object_ptr->sp] = chip8_object_ptr->PC;
+    
+    //Go to subroutine
+    chip8_object_ptr->PC = ins->nnn;
+}
+
+void return_from_subroutine(chip8 *chip8_object_ptr, const instruction *ins){
+    (void)ins;
+
+    if(chip8_object_ptr->sp >= STACK_SIZE){
+        printf("Stack underflow at 0x%03X\n", chip8_object_ptr->PC - 2);
+        chip8_object_ptr->state = NOT_RUNNING;
+        return;
+    }
+
+    //Assign PC the value on the top of the stack
+    chip8_object_ptr->PC = chip8_object_ptr->stack[chip8_object_ptr->sp];
+    
+    //Update stack pointer
+    chip8_object_ptr->sp--;
+}
+
+//Skips step over the whole next instruction, F000 NNNN is four bytes long (XO-CHIP)
+__uint16_t skip_length(const chip8 *chip8_object_ptr){
+    __uint16_t pc = chip8_object_ptr->PC;
+
+    return (chip8_object_ptr->RAM[pc & (RAM_SIZE - 1)] == 0xF0 && chip8_object_ptr->RAM[(pc + 1) & (RAM_SIZE - 1)] == 0x00) ? 4 : 2;
+}
+
+void skip_constant_equal(chip8 *chip8_object_ptr, const instruction *ins){
+    if(chip8_object_ptr->registers[ins->x] == ins->nn){
+        chip8_object_ptr->PC+=skip_length(chip8_object_ptr);
+    }
+}
+
+void skip_not_constant_equal(chip8 *chip8_object_ptr, const instruction *ins){
+    if(chip8_object_ptr->registers[ins->x] != ins->nn){
+        chip8_object_ptr->PC+=skip_length(chip8_object_ptr);
+    }
+}
+
+void skip_register_equal(chip8 *chip8_object_ptr, const instruction *ins){
+    if(chip8_object_ptr->registers[ins->x] == chip8_object_ptr->registers[ins->y]){
+        chip8_object_ptr->PC+=skip_length(chip8_object_ptr);
+    }
+}
+
+void skip_register_not_equal(chip8 *chip8_object_ptr, const instruction *ins){
+    if(chip8_object_ptr->registers[ins->x] != chip8_object_ptr->registers[ins->y]){
+        chip8_object_ptr->PC+=skip_length(chip8_object_ptr);
+    }
+}
+
+void jump_with_offset(chip8 *chip8_object_ptr, const instruction *ins){
+    chip8_object_ptr->PC = (ins->nnn + chip8_object_ptr->registers[0x0]);
+}
+
+void seed_chip8(chip8 *chip8_object_ptr, __uint32_t seed){
+    //xorshift gets stuck on 0
+    chip8_object_ptr->rng_state = seed ? seed : 0x9E3779B9;
+}
+
+void random_number(chip8 *chip8_object_ptr, const instruction *ins){
+    //xorshift32, each machine has its own state so several can run side by side
+    __uint32_t x = chip8_object_ptr->rng_state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    chip8_object_ptr->rng_state = x;
+
+    __uint8_t nn = ins->nn;
+    chip8_object_ptr->registers[ins->x] = (x >> 24) & nn;
+}
+
+void set_vx_vy(chip8 *chip8_object_ptr, const instruction *ins){
+    chip8_object_ptr->registers[ins->x] = chip8_object_ptr->registers[ins->y];
+}
+
+void binary_or(chip8 *chip8_object_ptr, const instruction *ins){
+    chip8_object_ptr->registers[ins->x] |= chip8_object_ptr->registers[ins->y];
+}
+
+void binary_and(chip8 *chip8_object_ptr, const instruction *ins){
+    chip8_object_ptr->registers[ins->x] &= chip8_object_ptr->registers[ins->y];
+}
+
+void binary_xor(chip8 *chip8_object_ptr, const instruction *ins){
+    chip8_object_ptr->registers[ins->x] ^= chip8_object_ptr->registers[ins->y];
+}
+
+//The COSMAC VIP's logic ops clear VF as a side effect
+void binary_or_reset_vf(chip8 *chip8_object_ptr, const instruction *ins){
+    binary_or(chip8_object_ptr, ins);
+    chip8_object_ptr->registers[0xf] = 0;
+}
+
+void binary_and_reset_vf(chip8 *chip8_object_ptr, const instruction *ins){
+    binary_and(chip8_object_ptr, ins);
+    chip8_object_ptr->registers[0xf] = 0;
+}
+
+void binary_xor_reset_vf(chip8 *chip8_object_ptr, const instruction *ins){
+    binary_xor(chip8_object_ptr, ins);
+    chip8_object_ptr->registers[0xf] = 0;
+}
+
+void subtract_vx_vy(chip8 *chip8_object_ptr, const instruction *ins){
+    __uint8_t carry = chip8_object_ptr->registers[ins->x] > chip8_object_ptr->registers[ins->y];
+    
+    chip8_object_ptr->registers[ins->x] -= chip8_object_ptr->registers[ins->y];
+    
+    chip8_object_ptr->registers[0xf] = carry;
+}
+
+void subtract_vy_vx(chip8 *chip8_object_ptr, const instruction *ins){
+    __uint8_t carry = chip8_object_ptr->registers[ins->x] < chip8_object_ptr->registers[ins->y];
+    
+    chip8_object_ptr->registers[ins->x] = chip8_object_ptr->registers[ins->y] - chip8_object_ptr->registers[ins->x];
+
+    chip8_object_ptr->registers[0xf] = carry;
+}
+
+void add(chip8 *chip8_object_ptr, const instruction *ins){
+    __uint16_t carry = (uint16_t)(chip8_object_ptr->registers[ins->x] + chip8_object_ptr->registers[ins->y] > 255);
+    
+    chip8_object_ptr->registers[ins->x] += chip8_object_ptr->registers[ins->y];
+
+    chip8_object_ptr->registers[0xf] = carry;
+} 
+
+//SUPER-CHIP shifts VX in place, the others shift VY into VX
+static inline void shift_right_quirk(chip8 *chip8_object_ptr, const instruction *ins, const int shift_vy){
+    __uint8_t source = chip8_object_ptr->registers[shift_vy ? ins->y : ins->x];
+    __uint8_t carry = source & 0x01;
+
+    chip8_object_ptr->registers[ins->x] = source >> 1;
+
+    chip8_object_ptr->registers[0xf] = carry;
+}
+
+static inline void shift_left_quirk(chip8 *chip8_object_ptr, const instruction *ins, const int shift_vy){
+    __uint8_t source = chip8_object_ptr->registers[shift_vy ? ins->y : ins->x];
+    __uint8_t carry = (source & 0x80) >> 7;
+    
+    chip8_object_ptr->registers[ins->x] = source << 1;
+        
+    chip8_object_ptr->registers[0xf] = carry;
+}
+
+void shift_right(chip8 *chip8_object_ptr, const instruction *ins){
+    shift_right_quirk(chip8_object_ptr, ins, 1);
+}
+
+void shift_left(chip8 *chip8_object_ptr, const instruction *ins){
+    shift_left_quirk(chip8_object_ptr, ins, 1);
+}
+
+void shift_right_vx(chip8 *chip8_object_ptr, const instruction *ins){
+    shift_right_quirk(chip8_object_ptr, ins, 0);
+}
+
+void shift_left_vx(chip8 *chip8_object_ptr, const instruction *ins){
+    shift_left_quirk(chip8_object_ptr, ins, 0);
+}
+
+void ram_written(chip8 *chip8_object_ptr, __uint16_t address, __uint16_t len){
+    //An instruction starting one byte before the write also contains a written byte
+    for(int i=-1; i<len; i++){
+        chip8_object_ptr->decoded[(address + i) & (RAM_SIZE - 1)].handler = NULL;
+    }
+
+    //Let the block engine know which pages hold stale translations; with 64 KB of RAM
+    //  the engines only look at the range of pages written, not the whole bitmap
+    for(int i=0; i<len; i++){
+        __uint16_t page = ((address + i) & (RAM_SIZE - 1)) / CODE_PAGE_SIZE;
+        chip8_object_ptr->written_pages[page / 8] |= 1 << (page % 8);
+
+        if(!chip8_object_ptr->pages_written){
+            chip8_object_ptr->pages_written = 1;
+            chip8_object_ptr->first_written_page = page;
+            chip8_object_ptr->last_written_page = page;
+        }
+        if(page < chip8_object_ptr->first_written_page) chip8_object_ptr->first_written_page = page;
+        if(page > chip8_object_ptr->last_written_page) chip8_object_ptr->last_written_page = page;
+    }
+}
+
+void clear_written_pages(chip8 *chip8_object_ptr){
+    int first = chip8_object_ptr->first_written_page / 8;
+    int last = chip8_object_ptr->last_written_page / 8;
+
+    memset(chip8_object_ptr->written_pages + first, 0, last - first + 1);
+    chip8_object_ptr->pages_written = 0;
+}
+
+//The COSMAC VIP and XO-CHIP leave I pointing past the last register stored or loaded
+static inline void store_memory_quirk(chip8 *chip8_object_ptr, const instruction *ins, const int increment_i){
+    __uint8_t n = ins->x;
+    
+    for(int i=0; i<=n; i++){
+        chip8_object_ptr->RAM[(chip8_object_ptr->I + i) & (RAM_SIZE - 1)] = chip8_object_ptr->registers[i];
+    }
+
+    ram_written(chip8_object_ptr, chip8_object_ptr->I, n + 1);
+
+    if(increment_i) chip8_object_ptr->I += n + 1;
+}
+
+static inline void load_memory_quirk(chip8 *chip8_object_ptr, const instruction *ins, const int increment_i){
+    __uint8_t n = ins->x;
+
+    for(int i=0; i<=n; i++){
+        chip8_object_ptr->registers[i] = chip8_object_ptr->RAM[(chip8_object_ptr->I + i) & (RAM_SIZE - 1)];
+    }
+
+    if(increment_i) chip8_object_ptr->I += n + 1;
+}
+
+void store_memory(chip8 *chip8_object_ptr, const instruction *ins){
+    store_memory_quirk(chip8_object_ptr, ins, 0);
+}
+
+void load_memory(chip8 *chip8_object_ptr, const instruction *ins){
+    load_memory_quirk(chip8_object_ptr, ins, 0);
+}
+
+void store_memory_increment(chip8 *chip8_object_ptr, const instruction *ins){
+    store_memory_quirk(chip8_object_ptr, ins, 1);
+}
+
+void load_memory_increment(chip8 *chip8_object_ptr, const instruction *ins){
+    load_memory_quirk(chip8_object_ptr, ins, 1);
+}
+
+void add_to_index(chip8 *chip8_object_ptr, const instruction *ins){
+    chip8_object_ptr->I += chip8_object_ptr->registers[ins->x];
+}
+
+void decimal_conversion(chip8 *chip8_object_ptr, const instruction *ins){
+    __uint8_t n = chip8_object_ptr->registers[ins->x];
+    __uint8_t values[] = {n / 100, (n % 100) / 10, (n % 100) % 10}; 
+    for(int i=0; i<3; i++){
+        chip8_object_ptr->RAM[(chip8_object_ptr->I + i) & (RAM_SIZE - 1)] = values[i];
+    }
+
+    ram_written(chip8_object_ptr, chip8_object_ptr->I, 3);
+}
+
+void font_char(chip8 *chip8_object_ptr, const instruction *ins){
+    chip8_object_ptr->I = (chip8_object_ptr->registers[ins->x]) * 5;
+}
+
+void big_font_char(chip8 *chip8_object_ptr, const instruction *ins){
+    chip8_object_ptr->I = BIG_FONT_ADDRESS + (chip8_object_ptr->registers[ins->x] & 0xf) * 10;
+}
+
+void save_flags(chip8 *chip8_object_ptr, const instruction *ins){
+    //V0..VX, there are only RPL_FLAGS of them
+    for(int i=0; i<=ins->x && i<RPL_FLAGS; i++){
+        chip8_object_ptr->rpl[i] = chip8_object_ptr->registers[i];
+    }
+}
+
+void load_flags(chip8 *chip8_object_ptr, const instruction *ins){
+    for(int i=0; i<=ins->x && i<RPL_FLAGS; i++){
+        chip8_object_ptr->registers[i] = chip8_object_ptr->rpl[i];
+    }
+}
+
+void long_index(chip8 *chip8_object_ptr, const instruction *ins){
+    //0xF000 NNNN: the address is the next word, PC already points at it
+    (void)ins;
+    __uint16_t pc = chip8_object_ptr->PC;
+
+    chip8_object_ptr->I = (chip8_object_ptr->RAM[pc & (RAM_SIZE - 1)] << 8) | chip8_object_ptr->RAM[(pc + 1) & (RAM_SIZE - 1)];
+    chip8_object_ptr->PC += 2;
+}
+
+void save_range(chip8 *chip8_object_ptr, const instruction *ins){
+    //0x5XY2: VX..VY to I onwards, in descending register order when X > Y; I is left alone
+    int step = (ins->x <= ins->y) ? 1 : -1;
+    int count = (ins->x <= ins->y) ? ins->y - ins->x + 1 : ins->x - ins->y + 1;
+
+    for(int i=0; i<count; i++){
+        chip8_object_ptr->RAM[(chip8_object_ptr->I + i) & (RAM_SIZE - 1)] = chip8_object_ptr->registers[ins->x + i * step];
+    }
+
+    ram_written(chip8_object_ptr, chip8_object_ptr->I, count);
+}
+
+void load_range(chip8 *chip8_object_ptr, const instruction *ins){
+    //0x5XY3
+    int step = (ins->x <= ins->y) ? 1 : -1;
+    int count = (ins->x <= ins->y) ? ins->y - ins->x + 1 : ins->x - ins->y + 1;
+
+    for(int i=0; i<count; i++){
+        chip8_object_ptr->registers[ins->x + i * step] = chip8_object_ptr->RAM[(chip8_object_ptr->I + i) & (RAM_SIZE - 1)];
+    }
+}
+
+void load_audio_pattern(chip8 *chip8_object_ptr, const instruction *ins){
+    //0xF002: 16 bytes from I
+    (void)ins;
+
+    for(int i=0; i<AUDIO_PATTERN_SIZE; i++){
+        chip8_object_ptr->audio_pattern[i] = chip8_object_ptr->RAM[(chip8_object_ptr->I + i) & (RAM_SIZE - 1)];
+    }
+    chip8_object_ptr->audio_pattern_loaded = 1;
+}
+
+void set_pitch(chip8 *chip8_object_ptr, const instruction *ins){
+    chip8_object_ptr->pitch = chip8_object_ptr->registers[ins->x];
+}
+
+void set_vx_delaytimer(chip8 *chip8_object_ptr, const instruction *ins){
+    chip8_object_ptr->registers[ins->x] = chip8_object_ptr->delay_timer;
+}
+
+void set_delaytimer_vx(chip8 *chip8_object_ptr, const instruction *ins){
+    chip8_object_ptr->delay_timer = chip8_object_ptr->registers[ins->x];
+}
+
+void set_soundtimer_vx(chip8 *chip8_object_ptr, const instruction *ins){
+    chip8_object_ptr->sound_timer = chip8_object_ptr->registers[ins->x];
+}
+
+void get_key(chip8 *chip8_object_ptr, const instruction *ins){
+    //The wait lives in the machine rather than in statics, so every instance waits on its own keys;
+    //  the lowest key held is the one waited on
+    if(!chip8_object_ptr->key_waiting && chip8_object_ptr->keys){
+        chip8_object_ptr->waited_key = __builtin_ctz(chip8_object_ptr->keys);
+        chip8_object_ptr->key_waiting = 1;
+    }
+
+    if(!chip8_object_ptr->key_waiting){
+        chip8_object_ptr->PC-=2;
+        if(chip8_object_ptr->profile) chip8_object_ptr->profile->key_wait_spins++;
+    }else{
+        if(KEY_DOWN(chip8_object_ptr, chip8_object_ptr->waited_key)){
+            chip8_object_ptr->PC-=2;
+            if(chip8_object_ptr->profile) chip8_object_ptr->profile->key_wait_spins++;
+        }else{
+            chip8_object_ptr->registers[ins->x] = chip8_object_ptr->waited_key;
+            chip8_object_ptr->key_waiting = 0;
+        }
+    }
+}
+
+/*
+Whether the machine can't do anything until the keypad changes: PC is on an
+Fx0A that is waiting for a press (or for the release of the key it saw) and
+neither timer is running, so further frames would only spin on the same
+instruction. The frontend parks instead of emulating them.
+*/
+int blocked_on_key(chip8 *chip8_object_ptr){
+    const instruction *ins = &chip8_object_ptr->decoded[chip8_object_ptr->PC & (RAM_SIZE - 1)];
+
+    if(chip8_object_ptr->state || chip8_object_ptr->delay_timer || chip8_object_ptr->sound_timer) return 0;
+
+    if(!ins->handler){
+        ins = decode_instruction(chip8_object_ptr, chip8_object_ptr->PC);
+    }
+    if(ins->handler != get_key) return 0;
+
+    //Waiting for a release, only that key matters; waiting for a press, any held key ends the wait
+    if(chip8_object_ptr->key_waiting){
+        return KEY_DOWN(chip8_object_ptr, chip8_object_ptr->waited_key);
+    }
+    return !chip8_object_ptr->keys;
+}
+
+void skip_if_key(chip8 *chip8_object_ptr, const instruction *ins){
+    if(KEY_DOWN(chip8_object_ptr, chip8_object_ptr->registers[ins->x])){
+        chip8_object_ptr->PC+=skip_length(chip8_object_ptr);
+    }
+}
+
+void skip_if_not_key(chip8 *chip8_object_ptr, const instruction *ins){
+    if(!KEY_DOWN(chip8_object_ptr, chip8_object_ptr->registers[ins->x])){
+        chip8_object_ptr->PC+=skip_length(chip8_object_ptr);
+    }
+}
+
+void decrement_delay_timer(chip8 *chip8_obj_ptr){
+    if(chip8_obj_ptr->delay_timer > 0){
+        chip8_obj_ptr->delay_timer--;
+    }
+}
+
+void decrement_sound_timer(chip8 *chip8_obj_ptr){
+    if(chip8_obj_ptr->sound_timer > 0){
+        chip8_obj_ptr->sound_timer--;
+    }
+}
+
+long instructions_for_frame(const chip8 *chip8_object_ptr, long ips){
+    //ips is spread over TIMER_HZ frames a second, the fractional part carries over to later frames;
+    //the pattern repeats every TIMER_HZ frames so only the position within that second matters
+    long long frame = chip8_object_ptr->frames % TIMER_HZ;
+
+    return (long)(((frame + 1) * ips) / TIMER_HZ - (frame * ips) / TIMER_HZ);
+}
+
+//Timer tick at the end of a frame
+void end_frame(chip8 *chip8_object_ptr){
+    chip8_object_ptr->beeping = chip8_object_ptr->sound_timer > 0;
+
+    decrement_delay_timer(chip8_object_ptr);
+    decrement_sound_timer(chip8_object_ptr);
+
+    chip8_object_ptr->frames++;
+}
+
+void run_frame(chip8 *chip8_object_ptr, long ips){
+    execute_instructions(chip8_object_ptr, instructions_for_frame(chip8_object_ptr, ips));
+
+    //A halted machine's frame doesn't end, its timers and frame count stay where they stopped
+    if(chip8_object_ptr->state == RUNNING) end_frame(chip8_object_ptr);
+}
+
+/*
+One line describing the instruction at pc, given the registers, I and the
+top of the stack just before it runs. Shared by debug() and the offline
+trace decoder, so both print the same text.
+*/
+void print_instruction(FILE *out, __uint16_t pc, __uint16_t ins, const __uint8_t *registers, __uint16_t I, __uint16_t stack_top){
+    
+    fprintf(out, "%hx  ", pc);
+    
+    switch (first_nible)
+    {
+    case 0x0:
+        if(ins & 0x00e0){
+            // 0x00E0: Clear the screen
+            fprintf(out, "Clear screen\n");
+        }else if(ins & 0x00ee){
+            // 0x00E0: Return from subroutine
+            fprintf(out, "Return from subroutine to address 0x%04X\n",
+            stack_top);
+        }else{
+            fprintf(out, "Uniplimented opcode\n");
+        }
+        break;
+    case 0x1:
+        // 0x1NNN: Jump to address NNN
+        fprintf(out, "Jump to address NNN (0x%04X)\n",
+            (ins & 0x0fff));   
+        break;
+    case 0x2:
+        // 0x2NNN: Call subroutine at NNN
+        fprintf(out, "Call subroutine at NNN (0x%04X)\n",
+            (ins & 0x0fff));
+        break;
+    case 0x3:
+        // 0x3XNN: Check if VX == NN, if so, skip the next instruction
+        fprintf(out, "Check if V%X (0x%02X) == NN (0x%02X), skip next instruction if true\n",
+                   second_nible, registers[second_nible], ins & 0x00ff);
+        break;
+    case 0x4:
+        // 0x4XNN: Check if VX != NN, if so, skip the next instruction
+        fprintf(out, "Check if V%X (0x%02X) != NN (0x%02X), skip next instruction if true\n",
+                   second_nible, registers[second_nible], ins & 0x00ff);
+        break;
+    case 0x5:
+        // 0x5XY0: Check if VX == VY, if so, skip the next instruction
+        fprintf(out, "Check if V%X (0x%02X) == V%X (0x%02X), skip next instruction if true\n",
+            second_nible, registers[second_nible], 
+            third_nible, registers[third_nible]);
+        break;
+    case 0x06:
+        // 0x6XNN: Set register VX to NN
+        fprintf(out, "Set register V%X = NN (0x%02X)\n",
+            second_nible, ins & 0x00ff);
+        break;
+    case 0x07:
+        // 0x7XNN: Set register VX += NN
+        fprintf(out, "Set register V%X (0x%02X) += NN (0x%02X). Result: 0x%02X\n",
+            second_nible, registers[second_nible], ins & 0x00ff,
+            registers[second_nible] + (ins & 0x00ff));
+        break;
+    case 0x8:
+        switch (fourth_nible)
+        {
+        
+        case 0:
+            // 0x8XY0: Set register VX = VY
+            fprintf(out, "Set register V%X = V%X (0x%02X)\n",
+                second_nible, third_nible, registers[third_nible]);
+            break;
+        case 1:
+            // 0x8XY1: Set register VX |= VY
+            fprintf(out, "Set register V%X (0x%02X) |= V%X (0x%02X); Result: 0x%02X\n",
+                second_nible, registers[second_nible],
+                third_nible, registers[third_nible],
+                registers[second_nible] | registers[third_nible]);
+            break;
+        case 2:
+            // 0x8XY2: Set register VX &= VY
+            fprintf(out, "Set register V%X (0x%02X) &= V%X (0x%02X); Result: 0x%02X\n",
+                second_nible, registers[second_nible],
+                third_nible, registers[third_nible],
+                registers[second_nible] & registers[third_nible]);
+            break;
+        case 3:
+            // 0x8XY3: Set register VX ^= VY
+            fprintf(out, "Set register V%X (0x%02X) ^= V%X (0x%02X); Result: 0x%02X\n",
+                second_nible, registers[second_nible],
+                third_nible, registers[third_nible],
+                registers[second_nible] ^ registers[third_nible]);
+             break;
+        case 4:
+            // 0x8XY4: Set register VX += VY, set VF to 1 if carry
+            fprintf(out, "Set register V%X (0x%02X) += V%X (0x%02X), VF = 1 if carry; Result: 0x%02X, VF = %X\n",
+                second_nible, registers[second_nible],
+                third_nible, registers[third_nible],
+                registers[second_nible] + registers[third_nible],
+                ((uint16_t)registers[second_nible] + registers[third_nible]) > 255);
+            break;
+        case 5:
+            // 0x8XY5: Set register VX -= VY, set VF to 1 if there is not a borrow (result is positive/0)
+            fprintf(out, "Set register V%X (0x%02X) -= V%X (0x%02X), VF = 1 if no borrow; Result: 0x%02X, VF = %X\n",
+                second_nible, registers[second_nible],
+                third_nible, registers[third_nible],
+                registers[second_nible] - registers[third_nible],
+                (registers[second_nible] <= registers[third_nible]));
+            break;
+        case 6:
+            // 0x8XY6: Set register VX >>= 1, store shifted off bit in VF
+            fprintf(out, "Set register V%X (0x%02X) >>= 1, VF = shifted off bit (%X); Result: 0x%02X\n",
+                second_nible, registers[second_nible],
+                registers[second_nible] & 1,
+                registers[second_nible] >> 1);
+            break;
+        case 7:
+            // 0x8XY7: Set register VX = VY - VX, set VF to 1 if there is not a borrow (result is positive/0)
+            fprintf(out, "Set register V%X = V%X (0x%02X) - V%X (0x%02X), VF = 1 if no borrow; Result: 0x%02X, VF = %X\n",
+                second_nible, third_nible, registers[third_nible],
+                second_nible, registers[second_nible],
+                registers[third_nible] - registers[second_nible],
+                (registers[second_nible] <= registers[third_nible]));
+            break;
+        case 0xE:
+            // 0x8XYE: Set register VX <<= 1, store shifted off bit in VF
+            fprintf(out, "Set register V%X (0x%02X) <<= 1, VF = shifted off bit (%X); Result: 0x%02X\n",
+                second_nible, registers[second_nible],
+                (registers[second_nible] >> 7) & 0x1,
+                registers[second_nible] << 1);
+            break;
+        }
+    break;
+    case 0x9:
+        // 0x9XY0: Check if VX != VY; Skip next instruction if so
+        fprintf(out, "Check if V%X (0x%02X) != V%X (0x%02X), skip next instruction if true\n",
+            second_nible, registers[second_nible], 
+            third_nible, registers[third_nible]);
+        break;
+    case 0xa:
+        // 0xANNN: Set index register I to NNN
+        fprintf(out, "Set I to NNN (0x%04X)\n",
+            ins & 0x0fff);
+        break;
+    case 0xb:
+        // 0xBNNN: Jump to V0 + NNN
+        fprintf(out, "Set PC to V0 (0x%02X) + NNN (0x%04X); Result PC = 0x%04X\n",
+            registers[0x0], ins & 0x0fff, registers[0x0] + (ins & 0x0fff));
+        break;
+    case 0xc:
+        // 0xCXNN: Sets register VX = rand() % 256 & NN (bitwise AND)
+        fprintf(out, "Set V%X = rand() %% 256 & NN (0x%02X)\n",
+            second_nible, ins & 0x00ff);
+        break;
+    case 0xd:
+        // 0xDXYN: Draw N-height sprite at coords X,Y; Read from memory location I;
+        //   Screen pixels are XOR'd with sprite bits, 
+        //   VF (Carry flag) is set if any screen pixels are set off; This is useful
+        //   for collision detection or other reasons.
+        fprintf(out, "Draw N (%u) height sprite at coords V%X (0x%02X), V%X (0x%02X) "
+            "from memory location I (0x%04X). Set VF = 1 if any pixels are turned off.\n",
+            fourth_nible, second_nible, registers[second_nible], third_nible,
+            registers[third_nible], I);
+        break;
+    default:
+        break;
+    }
+}
+
+void debug(chip8 *chip8_obj_ptr, __uint16_t ins){
+    //sp is 0xFF while the stack is empty
+    __uint16_t stack_top = (chip8_obj_ptr->sp < STACK_SIZE) ? chip8_obj_ptr->stack[chip8_obj_ptr->sp] : 0;
+
+    print_instruction(stdout, chip8_obj_ptr->PC, ins, chip8_obj_ptr->registers, chip8_obj_ptr->I, stack_top);
+}
+
+void unimplemented(chip8 *chip8_object_ptr, const instruction *ins){
+    (void)chip8_object_ptr;
+    (void)ins;
+    printf("Unimplemented\n");
+}
+
+void no_operation(chip8 *chip8_object_ptr, const instruction *ins){
+    (void)chip8_object_ptr;
+    (void)ins;
+}
+
+const handler_name handler_names[] = {
+    {set_register_value, "set_register_value"},
+    {add_register_value, "add_register_value"},
+    {clear_screen, "clear_screen"},
+    {set_pc, "set_pc"},
+    {set_i, "set_i"},
+    {display_fun, "display_fun"},
+    {call_subroutine, "call_subroutine"},
+    {return_from_subroutine, "return_from_subroutine"},
+    {skip_constant_equal, "skip_constant_equal"},
+    {skip_not_constant_equal, "skip_not_constant_equal"},
+    {skip_register_equal, "skip_register_equal"},
+    {skip_register_not_equal, "skip_register_not_equal"},
+    {jump_with_offset, "jump_with_offset"},
+    {random_number, "random_number"},
+    {set_vx_vy, "set_vx_vy"},
+    {binary_or, "binary_or"},
+    {binary_and, "binary_and"},
+    {binary_xor, "binary_xor"},
+    {subtract_vx_vy, "subtract_vx_vy"},
+    {subtract_vy_vx, "subtract_vy_vx"},
+    {add, "add"},
+    {shift_right, "shift_right"},
+    {shift_left, "shift_left"},
+    {store_memory, "store_memory"},
+    {load_memory, "load_memory"},
+    {add_to_index, "add_to_index"},
+    {decimal_conversion, "decimal_conversion"},
+    {font_char, "font_char"},
+    {set_vx_delaytimer, "set_vx_delaytimer"},
+    {set_delaytimer_vx, "set_delaytimer_vx"},
+    {set_soundtimer_vx, "set_soundtimer_vx"},
+    {get_key, "get_key"},
+    {skip_if_key, "skip_if_key"},
+    {skip_if_not_key, "skip_if_not_key"},
+    {unimplemented, "unimplemented"},
+    {no_operation, "no_operation"},
+    {scroll_down, "scroll_down"},
+    {scroll_right, "scroll_right"},
+    {scroll_left, "scroll_left"},
+    {exit_interpreter, "exit_interpreter"},
+    {low_resolution, "low_resolution"},
+    {high_resolution, "high_resolution"},
+    {big_font_char, "big_font_char"},
+    {save_flags, "save_flags"},
+    {load_flags, "load_flags"},
+    {scroll_up, "scroll_up"},
+    {select_planes, "select_planes"},
+    {long_index, "long_index"},
+    {save_range, "save_range"},
+    {load_range, "load_range"},
+    {load_audio_pattern, "load_audio_pattern"},
+    {set_pitch, "set_pitch"},
+    {display_fun_wrap, "display_fun_wrap"},
+    {binary_or_reset_vf, "binary_or_reset_vf"},
+    {binary_and_reset_vf, "binary_and_reset_vf"},
+    {binary_xor_reset_vf, "binary_xor_reset_vf"},
+    {shift_right_vx, "shift_right_vx"},
+    {shift_left_vx, "shift_left_vx"},
+    {store_memory_increment, "store_memory_increment"},
+    {load_memory_increment, "load_memory_increment"},
+};
+
+const size_t handler_count = sizeof handler_names / sizeof handler_names[0];
+
+const instruction *decode_instruction(chip8 *chip8_object_ptr, __uint16_t address){
+    __uint8_t opcode1 = chip8_object_ptr->RAM[address & (RAM_SIZE - 1)];
+    __uint8_t opcode2 = chip8_object_ptr->RAM[(address + 1) & (RAM_SIZE - 1)];
+    
+    __uint16_t ins = ((__uint16_t)opcode1 << 8 ) | opcode2;
+
+    instruction *decoded = &chip8_object_ptr->decoded[address & (RAM_SIZE - 1)];
+
+    decoded->opcode = ins;
+    decoded->nnn = ins & 0x0fff;
+    decoded->nn = ins & 0x00ff;
+    decoded->n = fourth_nible;
+    decoded->x = second_nible;
+    decoded->y = third_nible;
+    decoded->opclass = opcode_class(ins);
+    
+    /*
+    first_nible is the first 4 bits of the ins var
+    which decide the category of the opcode
+    */
+    static const handler_fn groups[16] = {
+        [0x1] = set_pc,
+        [0x2] = call_subroutine,
+        [0x3] = skip_constant_equal,
+        [0x4] = skip_not_constant_equal,
+        [0x5] = skip_register_equal,
+        [0x6] = set_register_value,
+        [0x7] = add_register_value,
+        [0x9] = skip_register_not_equal,
+        [0xA] = set_i,
+        [0xB] = jump_with_offset,
+        [0xC] = random_number,
+    };
+
+    //The tables below have one row per quirk profile, filled in from QUIRK_PROFILES
+    const quirk_profiles quirks = chip8_object_ptr->quirks;
+
+    //0xDXYN
+    static const handler_fn sprite[QUIRK_PROFILE_COUNT] = {
+#define SPRITE(profile, name, shift_vy, increment_i, reset_vf, wrap) \
+        [QUIRKS_##profile] = wrap ? display_fun_wrap : display_fun,
+        QUIRK_PROFILES(SPRITE)
+#undef SPRITE
+    };
+
+    //0x8XYN, selected by the last nibble
+    static const handler_fn arithmetic[QUIRK_PROFILE_COUNT][16] = {
+#define ARITHMETIC(profile, name, shift_vy, increment_i, reset_vf, wrap) \
+        [QUIRKS_##profile] = { \
+            [0x0] = set_vx_vy, \
+            [0x1] = reset_vf ? binary_or_reset_vf : binary_or, \
+            [0x2] = reset_vf ? binary_and_reset_vf : binary_and, \
+            [0x3] = reset_vf ? binary_xor_reset_vf : binary_xor, \
+            [0x4] = add, \
+            [0x5] = subtract_vx_vy, \
+            [0x6] = shift_vy ? shift_right : shift_right_vx, \
+            [0x7] = subtract_vy_vx, \
+            [0xE] = shift_vy ? shift_left : shift_left_vx, \
+        },
+        QUIRK_PROFILES(ARITHMETIC)
+#undef ARITHMETIC
+    };
+
+    //0xFXNN, selected by the last byte
+    static const handler_fn misc[QUIRK_PROFILE_COUNT][256] = {
+#define MISC(profile, name, shift_vy, increment_i, reset_vf, wrap) \
+        [QUIRKS_##profile] = { \
+            [0x00] = long_index, \
+            [0x01] = select_planes, \
+            [0x02] = load_audio_pattern, \
+            [0x07] = set_vx_delaytimer, \
+            [0x0A] = get_key, \
+            [0x15] = set_delaytimer_vx, \
+            [0x18] = set_soundtimer_vx, \
+            [0x1E] = add_to_index, \
+            [0x29] = font_char, \
+            [0x30] = big_font_char, \
+            [0x33] = decimal_conversion, \
+            [0x3A] = set_pitch, \
+            [0x55] = increment_i ? store_memory_increment : store_memory, \
+            [0x65] = increment_i ? load_memory_increment : load_memory, \
+            [0x75] = save_flags, \
+            [0x85] = load_flags, \
+        },
+        QUIRK_PROFILES(MISC)
+#undef MISC
+    };
+
+    //0x00NN, SUPER-CHIP screen control; 0x00CN and 0x00DN are handled below
+    static const handler_fn system[256] = {
+        [0xE0] = clear_screen,
+        [0xEE] = return_from_subroutine,
+        [0xFB] = scroll_right,
+        [0xFC] = scroll_left,
+        [0xFD] = exit_interpreter,
+        [0xFE] = low_resolution,
+        [0xFF] = high_resolution,
+    };
+
+    handler_fn handler = groups[first_nible];
+
+    switch(first_nible){
+        case 0x0:
+            if(ins & 0x0f00){
+                handler = unimplemented;
+            }else if((decoded->nn & 0xf0) == 0xc0){
+                handler = scroll_down;
+            }else if((decoded->nn & 0xf0) == 0xd0){
+                handler = scroll_up;
+            }else{
+                handler = system[decoded->nn] ? system[decoded->nn] : unimplemented;
+            }
+            break;
+        case 0x5:
+            //0x5XY2/0x5XY3 (XO-CHIP), any other last nibble compares like 0x5XY0 always did
+            if(decoded->n == 0x2){
+                handler = save_range;
+            }else if(decoded->n == 0x3){
+                handler = load_range;
+            }
+            break;
+        case 0x8:
+            handler = arithmetic[quirks][fourth_nible];
+            break;
+        case 0xD:
+            handler = sprite[quirks];
+            break;
+        case 0xE:
+            handler = (decoded->nn == 0x9e) ? skip_if_key : skip_if_not_key;
+            break;
+        case 0xF:
+            handler = misc[quirks][decoded->nn];
+            break;
+    }
+
+    //Opcodes the groups above don't know about are skipped like before
+    decoded->handler = handler ? handler : no_operation;
+
+    return decoded;
+}
+
+void execute_instruction(chip8 *chip8_object_ptr){
+    const instruction *ins = &chip8_object_ptr->decoded[chip8_object_ptr->PC & (RAM_SIZE - 1)];
+
+    //Decode on first use, the result stays cached until the RAM under it is written
+    if(!ins->handler){
+        ins = decode_instruction(chip8_object_ptr, chip8_object_ptr->PC);
+    }
+
+    #ifdef DEBUG
+    debug(chip8_object_ptr, ins->opcode);
+    #endif
+
+    if(chip8_object_ptr->trace){
+        trace_instruction(chip8_object_ptr->trace, chip8_object_ptr, chip8_object_ptr->PC, ins->opcode);
+    }
+
+    if(chip8_object_ptr->profile){
+        chip8_object_ptr->profile->class_counts[ins->opclass]++;
+        chip8_object_ptr->profile->address_counts[chip8_object_ptr->PC & (RAM_SIZE - 1)]++;
+    }
+
+    //PC points at the next instruction while the handler runs, jumps and skips overwrite/advance it
+    chip8_object_ptr->PC+=2;
+    ins->handler(chip8_object_ptr, ins);
+}
+
+/*
+Idle loops. ROMs wait for the delay timer with a spin like
+
+    Fx07    VX = DT
+    3x00    skip the jump once VX == 0
+    1NNN    back to the Fx07
+
+The timer only changes at the end of a frame, so once such a loop is
+entered with the skip not taken, every further pass until the frame ends
+does exactly the same thing: VX gets the value it already has and PC comes
+back to the Fx07. skip_idle_loop() recognises the loop at PC from the
+decoded instructions (any 3xNN/4xNN whose outcome is fixed for the frame,
+on any register) and consumes all the whole passes left in the budget in one step;
+the engine then runs the partial pass, so registers, PC and the
+instruction count end up exactly where running every pass would leave
+them. Profiles count the skipped instructions as executed. Traces need
+every instruction, so skipping is off while one is recorded.
+*/
+long skip_idle_loop(chip8 *chip8_object_ptr, long count){
+    __uint16_t pc = chip8_object_ptr->PC;
+    const instruction *ops[3];
+
+    if(!chip8_object_ptr->skip_idle || count < 3) return 0;
+
+    for(int i=0; i<3; i++){
+        ops[i] = &chip8_object_ptr->decoded[(pc + 2 * i) & (RAM_SIZE - 1)];
+        if(!ops[i]->handler){
+            ops[i] = decode_instruction(chip8_object_ptr, pc + 2 * i);
+        }
+    }
+
+    if(ops[0]->handler != set_vx_delaytimer || ops[2]->handler != set_pc || ops[2]->nnn != pc) return 0;
+    if(ops[1]->handler != skip_constant_equal && ops[1]->handler != skip_not_constant_equal) return 0;
+
+    //The compared value after the Fx07 ran, the loop only continues while the skip isn't taken
+    __uint8_t value = (ops[1]->x == ops[0]->x) ? chip8_object_ptr->delay_timer : chip8_object_ptr->registers[ops[1]->x];
+    int skipped = (ops[1]->handler == skip_constant_equal) ? (value == ops[1]->nn) : (value != ops[1]->nn);
+    if(skipped) return 0;
+
+    //After any number of whole passes PC is back at the Fx07 and VX holds DT
+    long passes = count / 3;
+
+    chip8_object_ptr->registers[ops[0]->x] = chip8_object_ptr->delay_timer;
+
+    if(chip8_object_ptr->profile){
+        for(int i=0; i<3; i++){
+            chip8_object_ptr->profile->class_counts[ops[i]->opclass] += passes;
+            chip8_object_ptr->profile->address_counts[(pc + 2 * i) & (RAM_SIZE - 1)] += passes;
+        }
+        chip8_object_ptr->profile->idle_skipped += 3 * passes;
+    }
+    return 3 * passes;
+}
+
+//Returns how many instructions ran, fewer than count if the machine halted
+long execute_instructions(chip8 *chip8_object_ptr, long count){
+    const long budget = count;
+
+    if(chip8_object_ptr->engine == ENGINE_BLOCK){
+        return execute_blocks(chip8_object_ptr, count);
+    }
+    if(chip8_object_ptr->engine == ENGINE_JIT){
+        return execute_jit(chip8_object_ptr, count);
+    }
+    if(chip8_object_ptr->engine == ENGINE_AOT){
+        return execute_aot(chip8_object_ptr, count);
+    }
+
+    //A halted machine (00FD, stack overflow or underflow) runs nothing more
+    while(count > 0 && chip8_object_ptr->state == RUNNING){
+        if(IDLE_LOOP_CANDIDATE(chip8_object_ptr)){
+            long skipped = skip_idle_loop(chip8_object_ptr, count);
+
+            if(skipped){
+                count -= skipped;
+                continue;
+            }
+        }
+
+        execute_instruction(chip8_object_ptr);
+        count--;
+    }
+    return budget - count;
+}
@@ -0,0 +1,467 @@
+#define _DEFAULT_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include "chip8.h"
+
+/*
+JIT engine: the same blocks the block engine uses are compiled to x86-64
+machine code. The chip8 struct stays the only copy of the machine state,
+the generated code keeps its address in rbx and reads/writes registers,
+I, PC and the timers at fixed offsets from it. Opcodes without a native
+translation (Dxyn, Fx0A, calls, ...) are emitted as calls to their handler
+in core.c. Code lives in an mmap'd arena that is only writable while a
+block is being emitted.
+*/
+
+#if defined(__x86_64__) && defined(__unix__)
+
+#include <sys/mman.h>
+
+//Executable memory reserved per machine, everything is dropped when it runs out
+#define JIT_ARENA_SIZE (1 << 20)
+
+//Upper bound on the code emitted for one block
+#define JIT_MAX_BLOCK_CODE (BLOCK_MAX_LENGTH * 64 + 64)
+
+//Runs the first count (1..length) instructions of a block
+typedef void (*jit_fn)(chip8 *chip8_object_ptr, long count);
+
+typedef struct jit_block{
+    __uint16_t start; //Address of the first instruction
+    __uint8_t length; //Number of instructions compiled
+    jit_fn code; //Entry point inside the arena
+    instruction ops[BLOCK_MAX_LENGTH]; //Operands passed to handlers the code calls back into
+} jit_block;
+
+typedef struct jit_cache{
+    jit_block *entries[RAM_SIZE]; //Compiled block starting at each address, NULL = not compiled yet
+    __uint8_t code_pages[CODE_PAGES]; //Pages some compiled block was read from
+    __uint8_t *arena; //mmap'd code memory
+    size_t used; //Bytes of arena handed out
+} jit_cache;
+
+//Code emission buffer
+typedef struct{
+    __uint8_t *code;
+    size_t len;
+} emitter;
+
+#define REG(n) (__int32_t)(offsetof(chip8, registers) + (n))
+#define OFFSET_PC (__int32_t)offsetof(chip8, PC)
+#define OFFSET_I (__int32_t)offsetof(chip8, I)
+#define OFFSET_DT (__int32_t)offsetof(chip8, delay_timer)
+#define OFFSET_ST (__int32_t)offsetof(chip8, sound_timer)
+#define OFFSET_KEYS (__int32_t)offsetof(chip8, keys)
+
+//ModRM byte for [rbx + disp32] with reg field r
+#define RBX_DISP32(r) (0x80 | ((r) << 3) | 3)
+
+//Host registers, by encoding
+#define AL 0
+#define CL 1
+#define DL 2
+
+static void emit8(emitter *e, __uint8_t byte){
+    e->code[e->len++] = byte;
+}
+
+static void emit16(emitter *e, __uint16_t value){
+    memcpy(e->code + e->len, &value, 2);
+    e->len += 2;
+}
+
+static void emit32(emitter *e, __int32_t value){
+    memcpy(e->code + e->len, &value, 4);
+    e->len += 4;
+}
+
+static void emit64(emitter *e, __uint64_t value){
+    memcpy(e->code + e->len, &value, 8);
+    e->len += 8;
+}
+
+//<opcode> reg8, byte [rbx + offset] or byte [rbx + offset], reg8 depending on opcode
+static void emit_rm8(emitter *e, __uint8_t opcode, int reg, __int32_t offset){
+    emit8(e, opcode);
+    emit8(e, RBX_DISP32(reg));
+    emit32(e, offset);
+}
+
+//mov byte [rbx + offset], imm8
+static void emit_store_imm8(emitter *e, __int32_t offset, __uint8_t value){
+    emit_rm8(e, 0xC6, 0, offset);
+    emit8(e, value);
+}
+
+//mov word [rbx + offset], imm16
+static void emit_store_imm16(emitter *e, __int32_t offset, __uint16_t value){
+    emit8(e, 0x66);
+    emit_rm8(e, 0xC7, 0, offset);
+    emit16(e, value);
+}
+
+//add word [rbx + offset], imm16
+static void emit_add_imm16(emitter *e, __int32_t offset, __uint16_t value){
+    emit8(e, 0x66);
+    emit_rm8(e, 0x81, 0, offset);
+    emit16(e, value);
+}
+
+//Jumps to the end of the epilogue are patched once its address is known
+static size_t emit_jump_placeholder(emitter *e){
+    emit8(e, 0xE9);
+    emit32(e, 0);
+    return e->len - 4;
+}
+
+static void emit_prologue(emitter *e){
+    emit8(e, 0x53); //push rbx
+    emit8(e, 0x41); emit8(e, 0x54); //push r12
+    emit8(e, 0x48); emit8(e, 0x83); emit8(e, 0xEC); emit8(e, 0x08); //sub rsp, 8 (keeps calls 16-byte aligned)
+    emit8(e, 0x48); emit8(e, 0x89); emit8(e, 0xFB); //mov rbx, rdi
+    emit8(e, 0x49); emit8(e, 0x89); emit8(e, 0xF4); //mov r12, rsi
+}
+
+static void emit_epilogue(emitter *e){
+    emit8(e, 0x48); emit8(e, 0x83); emit8(e, 0xC4); emit8(e, 0x08); //add rsp, 8
+    emit8(e, 0x41); emit8(e, 0x5C); //pop r12
+    emit8(e, 0x5B); //pop rbx
+    emit8(e, 0xC3); //ret
+}
+
+//handler(chip8_object_ptr, ins) for opcodes that stay in C
+static void emit_call_handler(emitter *e, const instruction *ins){
+    emit8(e, 0x48); emit8(e, 0x89); emit8(e, 0xDF); //mov rdi, rbx
+    emit8(e, 0x48); emit8(e, 0xBE); emit64(e, (__uint64_t)(uintptr_t)ins); //mov rsi, ins
+    emit8(e, 0x48); emit8(e, 0xB8); emit64(e, (__uint64_t)(uintptr_t)ins->handler); //mov rax, handler
+    emit8(e, 0xFF); emit8(e, 0xD0); //call rax
+}
+
+//VF = cl, VX = al; VF is written last like the C handlers do
+static void emit_store_result_and_flag(emitter *e, __uint8_t x){
+    emit_rm8(e, 0x88, AL, REG(x));
+    emit_rm8(e, 0x88, CL, REG(0xF));
+}
+
+//Skips: PC already points past the instruction, add 2 more when the condition holds
+//length is what skip_length() would return, fixed when the block is compiled
+static void emit_skip(emitter *e, __uint8_t jump_if_not_taken, __uint16_t length){
+    emit8(e, jump_if_not_taken);
+    emit8(e, 9); //size of the add below
+    emit_add_imm16(e, OFFSET_PC, length);
+}
+
+//Emits native code for ins, returns 0 when the opcode has no native translation
+static int emit_native(emitter *e, const instruction *ins, __uint16_t skip){
+    handler_fn handler = ins->handler;
+    __uint8_t x = ins->x;
+    __uint8_t y = ins->y;
+
+    if(handler == set_register_value){
+        emit_store_imm8(e, REG(x), ins->nn);
+    }else if(handler == add_register_value){
+        emit_rm8(e, 0x80, 0, REG(x)); //add byte [VX], nn
+        emit8(e, ins->nn);
+    }else if(handler == set_vx_vy){
+        emit_rm8(e, 0x8A, AL, REG(y));
+        emit_rm8(e, 0x88, AL, REG(x));
+    }else if(handler == binary_or || handler == binary_and || handler == binary_xor){
+        __uint8_t opcode = (handler == binary_or) ? 0x08 : (handler == binary_and) ? 0x20 : 0x30;
+        emit_rm8(e, 0x8A, AL, REG(y));
+        emit_rm8(e, opcode, AL, REG(x)); //op byte [VX], al
+    }else if(handler == binary_or_reset_vf || handler == binary_and_reset_vf || handler == binary_xor_reset_vf){
+        __uint8_t opcode = (handler == binary_or_reset_vf) ? 0x08 : (handler == binary_and_reset_vf) ? 0x20 : 0x30;
+        emit_rm8(e, 0x8A, AL, REG(y));
+        emit_rm8(e, opcode, AL, REG(x)); //op byte [VX], al
+        emit_store_imm8(e, REG(0xF), 0);
+    }else if(handler == add){
+        emit_rm8(e, 0x8A, AL, REG(x));
+        emit_rm8(e, 0x02, AL, REG(y)); //add al, VY
+        emit8(e, 0x0F); emit8(e, 0x92); emit8(e, 0xC1); //setc cl
+        emit_store_result_and_flag(e, x);
+    }else if(handler == subtract_vx_vy){
+        emit_rm8(e, 0x8A, AL, REG(x));
+        emit_rm8(e, 0x3A, AL, REG(y)); //cmp al, VY
+        emit8(e, 0x0F); emit8(e, 0x97); emit8(e, 0xC1); //seta cl
+        emit_rm8(e, 0x2A, AL, REG(y)); //sub al, VY
+        emit_store_result_and_flag(e, x);
+    }else if(handler == subtract_vy_vx){
+        emit_rm8(e, 0x8A, AL, REG(y));
+        emit_rm8(e, 0x8A, DL, REG(x));
+        emit8(e, 0x38); emit8(e, 0xD0); //cmp al, dl
+        emit8(e, 0x0F); emit8(e, 0x97); emit8(e, 0xC1); //seta cl
+        emit8(e, 0x28); emit8(e, 0xD0); //sub al, dl
+        emit_store_result_and_flag(e, x);
+    }else if(handler == shift_right || handler == shift_right_vx){
+        emit_rm8(e, 0x8A, AL, REG((handler == shift_right) ? y : x));
+        emit8(e, 0x88); emit8(e, 0xC1); //mov cl, al
+        emit8(e, 0x80); emit8(e, 0xE1); emit8(e, 0x01); //and cl, 1
+        emit8(e, 0xD0); emit8(e, 0xE8); //shr al, 1
+        emit_store_result_and_flag(e, x);
+    }else if(handler == shift_left || handler == shift_left_vx){
+        emit_rm8(e, 0x8A, AL, REG((handler == shift_left) ? y : x));
+        emit8(e, 0x88); emit8(e, 0xC1); //mov cl, al
+        emit8(e, 0xC0); emit8(e, 0xE9); emit8(e, 0x07); //shr cl, 7
+        emit8(e, 0x00); emit8(e, 0xC0); //add al, al
+        emit_store_result_and_flag(e, x);
+    }else if(handler == set_i){
+        emit_store_imm16(e, OFFSET_I, ins->nnn);
+    }else if(handler == add_to_index){
+        emit8(e, 0x0F); emit_rm8(e, 0xB6, AL, REG(x)); //movzx eax, VX
+        emit8(e, 0x66); emit_rm8(e, 0x01, AL, OFFSET_I); //add word [I], ax
+    }else if(handler == font_char){
+        emit8(e, 0x0F); emit_rm8(e, 0xB6, AL, REG(x)); //movzx eax, VX
+        emit8(e, 0x8D); emit8(e, 0x04); emit8(e, 0x80); //lea eax, [rax + rax * 4]
+        emit8(e, 0x66); emit_rm8(e, 0x89, AL, OFFSET_I); //mov word [I], ax
+    }else if(handler == set_vx_delaytimer){
+        emit_rm8(e, 0x8A, AL, OFFSET_DT);
+        emit_rm8(e, 0x88, AL, REG(x));
+    }else if(handler == set_delaytimer_vx){
+        emit_rm8(e, 0x8A, AL, REG(x));
+        emit_rm8(e, 0x88, AL, OFFSET_DT);
+    }else if(handler == set_soundtimer_vx){
+        emit_rm8(e, 0x8A, AL, REG(x));
+        emit_rm8(e, 0x88, AL, OFFSET_ST);
+    }else if(handler == set_pc){
+        emit_store_imm16(e, OFFSET_PC, ins->nnn);
+    }else if(handler == skip_constant_equal || handler == skip_not_constant_equal){
+        emit_rm8(e, 0x80, 7, REG(x)); //cmp byte [VX], nn
+        emit8(e, ins->nn);
+        emit_skip(e, (handler == skip_constant_equal) ? 0x75 : 0x74, skip); //jne / je over the add
+    }else if(handler == skip_register_equal || handler == skip_register_not_equal){
+        emit_rm8(e, 0x8A, AL, REG(x));
+        emit_rm8(e, 0x3A, AL, REG(y)); //cmp al, VY
+        emit_skip(e, (handler == skip_register_equal) ? 0x75 : 0x74, skip);
+    }else if(handler == skip_if_key || handler == skip_if_not_key){
+        emit8(e, 0x0F); emit_rm8(e, 0xB6, AL, REG(x)); //movzx eax, VX
+        emit8(e, 0x83); emit8(e, 0xE0); emit8(e, 0x0F); //and eax, 0xF
+        emit8(e, 0x66); emit8(e, 0x0F); emit_rm8(e, 0xA3, AL, OFFSET_KEYS); //bt word [keys], ax
+        emit_skip(e, (handler == skip_if_key) ? 0x73 : 0x72, skip); //jnc / jc over the add
+    }else if(handler == no_operation){
+        //Nothing to emit
+    }else{
+        return 0;
+    }
+    return 1;
+}
+
+int initialize_jit(chip8 *chip8_object_ptr){
+    if(chip8_object_ptr->jit) return 1;
+
+    jit_cache *cache = calloc(1, sizeof(jit_cache));
+    if(!cache){
+        printf("Error allocating JIT cache\n");
+        exit(1);
+    }
+
+    //Mapped read+execute, it's only made writable while a block is being emitted
+    cache->arena = mmap(NULL, JIT_ARENA_SIZE, PROT_READ | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(cache->arena == MAP_FAILED){
+        free(cache);
+        return 0;
+    }
+
+    //Hosts that forbid flipping a mapping between writable and executable can't run generated code
+    if(mprotect(cache->arena, JIT_ARENA_SIZE, PROT_READ | PROT_WRITE) != 0
+       || mprotect(cache->arena, JIT_ARENA_SIZE, PROT_READ | PROT_EXEC) != 0){
+        munmap(cache->arena, JIT_ARENA_SIZE);
+        free(cache);
+        return 0;
+    }
+
+    chip8_object_ptr->jit = cache;
+    return 1;
+}
+
+static void drop_all_blocks(jit_cache *cache){
+    for(int i=0; i<RAM_SIZE; i++){
+        free(cache->entries[i]);
+        cache->entries[i] = NULL;
+    }
+    memset(cache->code_pages, 0, sizeof cache->code_pages);
+    cache->used = 0;
+}
+
+void destroy_jit(chip8 *chip8_object_ptr){
+    jit_cache *cache = chip8_object_ptr->jit;
+
+    if(!cache) return;
+
+    drop_all_blocks(cache);
+    munmap(cache->arena, JIT_ARENA_SIZE);
+    free(cache);
+    chip8_object_ptr->jit = NULL;
+}
+
+//Writing into a mapping that is still executable only, or running one left writable, would crash
+static void protect_arena(jit_cache *cache, int protection){
+    if(mprotect(cache->arena, JIT_ARENA_SIZE, protection) != 0){
+        printf("Error changing JIT code protection\n");
+        exit(1);
+    }
+}
+
+static jit_block *compile_block(chip8 *chip8_object_ptr, __uint16_t start){
+    jit_cache *cache = chip8_object_ptr->jit;
+
+    //Old code can't be freed one block at a time, start over when the arena is full
+    if(cache->used + JIT_MAX_BLOCK_CODE > JIT_ARENA_SIZE){
+        drop_all_blocks(cache);
+    }
+
+    jit_block *new_block = malloc(sizeof(jit_block));
+    if(!new_block){
+        printf("Error allocating JIT block\n");
+        exit(1);
+    }
+
+    new_block->start = start;
+    new_block->length = 0;
+
+    //Same block boundaries as the block engine
+    __uint16_t address = start;
+    while(new_block->length < BLOCK_MAX_LENGTH){
+        const instruction *ins = &chip8_object_ptr->decoded[address & (RAM_SIZE - 1)];
+
+        if(!ins->handler){
+            ins = decode_instruction(chip8_object_ptr, address);
+        }
+
+        new_block->ops[new_block->length++] = *ins;
+        cache->code_pages[(address & (RAM_SIZE - 1)) / CODE_PAGE_SIZE] = 1;
+        cache->code_pages[((address + 1) & (RAM_SIZE - 1)) / CODE_PAGE_SIZE] = 1;
+
+        if(block_terminator(ins->handler)) break;
+
+        address += 2;
+    }
+
+    //A skip's length depends on the opcode after it, so the block also covers that word
+    __uint16_t next = start + 2 * new_block->length;
+    __uint16_t skip = (chip8_object_ptr->RAM[next & (RAM_SIZE - 1)] == 0xF0
+                    && chip8_object_ptr->RAM[(next + 1) & (RAM_SIZE - 1)] == 0x00) ? 4 : 2;
+    cache->code_pages[(next & (RAM_SIZE - 1)) / CODE_PAGE_SIZE] = 1;
+    cache->code_pages[((next + 1) & (RAM_SIZE - 1)) / CODE_PAGE_SIZE] = 1;
+
+    emitter e = {cache->arena + cache->used, 0};
+    size_t exits[BLOCK_MAX_LENGTH];
+    int exit_count = 0;
+
+    protect_arena(cache, PROT_READ | PROT_WRITE);
+
+    emit_prologue(&e);
+
+    for(int i=0; i<new_block->length; i++){
+        const instruction *ins = &new_block->ops[i];
+        int last = (i == new_block->length - 1);
+
+        //Only the last instruction can observe or change PC, set it once right before
+        if(last){
+            emit_store_imm16(&e, OFFSET_PC, start + 2 * new_block->length);
+        }
+
+        if(!emit_native(&e, ins, skip)){
+            emit_call_handler(&e, ins);
+        }
+
+        if(!last){
+            //Budget check: dec r12 / jnz next / PC = next instruction / jmp epilogue
+            emit8(&e, 0x49); emit8(&e, 0xFF); emit8(&e, 0xCC); //dec r12
+            emit8(&e, 0x75); emit8(&e, 14); //jnz over the exit
+            emit_store_imm16(&e, OFFSET_PC, start + 2 * (i + 1));
+            exits[exit_count++] = emit_jump_placeholder(&e);
+        }
+    }
+
+    size_t epilogue = e.len;
+    emit_epilogue(&e);
+
+    for(int i=0; i<exit_count; i++){
+        __int32_t rel = (__int32_t)(epilogue - (exits[i] + 4));
+        memcpy(e.code + exits[i], &rel, 4);
+    }
+
+    protect_arena(cache, PROT_READ | PROT_EXEC);
+
+    new_block->code = (jit_fn)(void *)e.code;
+    cache->used += (e.len + 15) & ~(size_t)15;
+
+    return new_block;
+}
+
+//Drop every compiled block that may overlap a page written since the last check
+static void flush_written_pages(chip8 *chip8_object_ptr){
+    jit_cache *cache = chip8_object_ptr->jit;
+
+    for(int page=chip8_object_ptr->first_written_page; page<=chip8_object_ptr->last_written_page; page++){
+        if(!(chip8_object_ptr->written_pages[page / 8] & (1 << (page % 8)))) continue;
+        if(!cache->code_pages[page]) continue;
+        cache->code_pages[page] = 0;
+
+        int first = page * CODE_PAGE_SIZE - 2 * BLOCK_MAX_LENGTH - 1;
+        int last = page * CODE_PAGE_SIZE + CODE_PAGE_SIZE - 1;
+
+        for(int address=first; address<=last; address++){
+            jit_block **entry = &cache->entries[address & (RAM_SIZE - 1)];
+            free(*entry);
+            *entry = NULL;
+        }
+    }
+
+    clear_written_pages(chip8_object_ptr);
+}
+
+long execute_jit(chip8 *chip8_object_ptr, long count){
+    jit_cache *cache = chip8_object_ptr->jit;
+    const long budget = count;
+
+    while(count > 0 && chip8_object_ptr->state == RUNNING){
+        if(chip8_object_ptr->pages_written){
+            flush_written_pages(chip8_object_ptr);
+        }
+
+        if(IDLE_LOOP_CANDIDATE(chip8_object_ptr)){
+            long skipped = skip_idle_loop(chip8_object_ptr, count);
+
+            if(skipped){
+                count -= skipped;
+                continue;
+            }
+        }
+
+        jit_block **entry = &cache->entries[chip8_object_ptr->PC & (RAM_SIZE - 1)];
+
+        //Still NULL while compile_block() runs, so dropping every block when the arena is full can't free it
+        if(!*entry){
+            *entry = compile_block(chip8_object_ptr, chip8_object_ptr->PC);
+        }
+
+        long run = ((*entry)->length < count) ? (*entry)->length : count;
+
+        (*entry)->code(chip8_object_ptr, run);
+        if(chip8_object_ptr->profile){
+            profile_block(chip8_object_ptr->profile, (*entry)->ops, (*entry)->start, run);
+        }
+        count -= run;
+    }
+    return budget - count;
+}
+
+#else
+
+int initialize_jit(chip8 *chip8_object_ptr){
+    (void)chip8_object_ptr;
+    return 0;
+}
+
+void destroy_jit(chip8 *chip8_object_ptr){
+    (void)chip8_object_ptr;
+}
+
+long execute_jit(chip8 *chip8_object_ptr, long count){
+    return execute_blocks(chip8_object_ptr, count);
+}
+
+#endif
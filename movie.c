@@ -0,0 +1,175 @@
+#include <stdlib.h>
+#include <string.h>
+#include "chip8.h"
+
+/*
+Input movies: the keypad state at every frame boundary plus the seed of the
+random number generator and the quirk profile, enough to replay a run bit
+for bit on any engine.
+
+File layout, integers little-endian:
+    "C8MV"  magic
+    u8      version (1)
+    u8      quirk profile (quirk_profiles, movies from before profiles hold 0, the default)
+    u8[2]   reserved, 0
+    u32     seed
+    u32     instructions per second
+followed by records, each starting with a varint v:
+    v & 1 == 0: the keys change to the u16 that follows, (v >> 1) frames after the previous record
+    v & 1 == 1: the movie ends (v >> 1) frames after the previous record
+A key change applies before the first instruction of its frame.
+*/
+
+#define MOVIE_VERSION 1
+
+static void write_u32(FILE *file, __uint32_t value){
+    for(int i=0; i<4; i++){
+        fputc((value >> (8 * i)) & 0xff, file);
+    }
+}
+
+static int read_u32(FILE *file, __uint32_t *value){
+    *value = 0;
+    for(int i=0; i<4; i++){
+        int byte = fgetc(file);
+        if(byte == EOF) return 0;
+        *value |= (__uint32_t)byte << (8 * i);
+    }
+    return 1;
+}
+
+static void write_varint(FILE *file, __uint64_t value){
+    while(value >= 0x80){
+        fputc((value & 0x7f) | 0x80, file);
+        value >>= 7;
+    }
+    fputc(value, file);
+}
+
+static int read_varint(FILE *file, __uint64_t *value){
+    *value = 0;
+    for(int shift=0; shift<64; shift+=7){
+        int byte = fgetc(file);
+        if(byte == EOF) return 0;
+        *value |= (__uint64_t)(byte & 0x7f) << shift;
+        if(!(byte & 0x80)) return 1;
+    }
+    return 0;
+}
+
+//Loads the next record, a missing or damaged tail ends the movie at the last good record
+static void read_record(movie *movie_ptr){
+    __uint64_t value;
+    int low, high;
+
+    if(!read_varint(movie_ptr->file, &value)){
+        movie_ptr->ended = 1;
+        movie_ptr->end_frame = movie_ptr->next_frame;
+        return;
+    }
+
+    movie_ptr->next_frame += value >> 1;
+
+    if(value & 1){
+        movie_ptr->ended = 1;
+        movie_ptr->end_frame = movie_ptr->next_frame;
+        return;
+    }
+
+    low = fgetc(movie_ptr->file);
+    high = fgetc(movie_ptr->file);
+    if(low == EOF || high == EOF){
+        movie_ptr->ended = 1;
+        movie_ptr->end_frame = movie_ptr->next_frame;
+        return;
+    }
+    movie_ptr->next_keys = low | (high << 8);
+}
+
+void start_recording(movie *movie_ptr, const char *path, __uint32_t seed, long ips, quirk_profiles quirks){
+    memset(movie_ptr, 0, sizeof *movie_ptr);
+
+    movie_ptr->file = fopen(path, "wb");
+    if(movie_ptr->file == NULL){
+        printf("Error creating movie %s\n", path);
+        exit(1);
+    }
+
+    movie_ptr->recording = 1;
+    movie_ptr->seed = seed;
+    movie_ptr->ips = ips;
+    movie_ptr->quirks = quirks;
+
+    fwrite("C8MV", 1, 4, movie_ptr->file);
+    fputc(MOVIE_VERSION, movie_ptr->file);
+    fputc(quirks, movie_ptr->file);
+    fputc(0, movie_ptr->file);
+    fputc(0, movie_ptr->file);
+    write_u32(movie_ptr->file, seed);
+    write_u32(movie_ptr->file, ips);
+}
+
+void start_playback(movie *movie_ptr, const char *path){
+    char magic[4];
+    __uint8_t header[4];
+
+    memset(movie_ptr, 0, sizeof *movie_ptr);
+
+    movie_ptr->file = fopen(path, "rb");
+    if(movie_ptr->file == NULL){
+        printf("Error opening movie %s\n", path);
+        exit(1);
+    }
+
+    if(fread(magic, 1, 4, movie_ptr->file) != 4 || memcmp(magic, "C8MV", 4)
+       || fread(header, 1, 4, movie_ptr->file) != 4 || header[0] != MOVIE_VERSION
+       || !read_u32(movie_ptr->file, &movie_ptr->seed) || !read_u32(movie_ptr->file, &movie_ptr->ips)
+       || movie_ptr->ips == 0){
+        printf("Not a chip8 movie: %s\n", path);
+        exit(1);
+    }
+
+    if(header[1] >= QUIRK_PROFILE_COUNT){
+        printf("Movie %s uses an unknown quirk profile\n", path);
+        exit(1);
+    }
+    movie_ptr->quirks = header[1];
+
+    read_record(movie_ptr);
+}
+
+void movie_frame(movie *movie_ptr, chip8 *chip8_object_ptr){
+    if(movie_ptr->recording){
+        __uint16_t keys = chip8_object_ptr->keys;
+
+        if(keys != movie_ptr->keys){
+            write_varint(movie_ptr->file, (chip8_object_ptr->frames - movie_ptr->frame) << 1);
+            fputc(keys & 0xff, movie_ptr->file);
+            fputc(keys >> 8, movie_ptr->file);
+            movie_ptr->keys = keys;
+            movie_ptr->frame = chip8_object_ptr->frames;
+        }
+        return;
+    }
+
+    while(!movie_ptr->ended && movie_ptr->next_frame <= chip8_object_ptr->frames){
+        movie_ptr->keys = movie_ptr->next_keys;
+        chip8_object_ptr->keys = movie_ptr->keys;
+        read_record(movie_ptr);
+    }
+}
+
+int movie_finished(const movie *movie_ptr, const chip8 *chip8_object_ptr){
+    return !movie_ptr->recording && movie_ptr->ended && chip8_object_ptr->frames >= movie_ptr->end_frame;
+}
+
+void stop_movie(movie *movie_ptr, const chip8 *chip8_object_ptr){
+    if(!movie_ptr->file) return;
+
+    if(movie_ptr->recording){
+        write_varint(movie_ptr->file, ((chip8_object_ptr->frames - movie_ptr->frame) << 1) | 1);
+    }
+
+    fclose(movie_ptr->file);
+    movie_ptr->file = NULL;
+}
@@ -0,0 +1,488 @@
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "chip8.h"
+
+/*
+Batch runner: executes a list of jobs (ROM, input script, cycle budget) headless
+on a pool of threads, one machine per worker. Jobs are dealt round-robin into
+per-worker queues up front; a worker takes from the back of its own queue and,
+once that is empty, steals from the front of the others, so a few long jobs
+don't leave the remaining threads idle.
+
+Job file, one job per line, '#' starts a comment:
+    <rom> <input script or -> <cycles> [seed [quirk profile]]
+A job without a quirk profile uses the one given with --quirks.
+
+Input script, one key change per line, sorted by frame:
+    <frame> <key 0-F> <down|up>
+A change takes effect before the first instruction of that frame.
+*/
+
+//One key change from an input script
+typedef struct{
+    __uint64_t frame; //Frame number the change applies at
+    __uint8_t key; //Keypad index 0x0-0xF
+    __uint8_t down; //1 = pressed, 0 = released
+} input_event;
+
+typedef struct{
+    char *rom; //Path of the ROM
+    char *script; //Path of the input script, NULL for none
+    long cycles; //Instruction budget
+    __uint32_t seed; //Cxkk seed, the job's line number unless given
+    quirk_profiles quirks; //Decode tables the job runs with
+    input_event *events;
+    size_t event_count;
+
+    //Filled in by the worker that ran the job
+    const char *failed; //Why the ROM couldn't be run, NULL if it ran
+    long instructions; //Instructions executed, below cycles if the machine stopped
+    __uint64_t frames; //Frames completed
+    __uint64_t hash; //FNV-1a of the final machine state
+    double seconds; //Wall time of the run
+    int worker; //Index of the worker that ran it
+} job;
+
+//Job indices owned by one worker, the owner pops at tail, thieves take from head
+typedef struct{
+    pthread_mutex_t lock;
+    size_t *jobs;
+    size_t head;
+    size_t tail;
+} job_queue;
+
+struct pool;
+
+typedef struct{
+    struct pool *pool;
+    int id;
+    pthread_t thread;
+    long jobs_run; //Jobs finished by this worker
+    long jobs_stolen; //How many of those came from another worker's queue
+} worker;
+
+typedef struct pool{
+    job *jobs;
+    size_t job_count;
+    job_queue *queues;
+    worker *workers;
+    int threads;
+    engines engine;
+    long ips;
+    const char *cache_directory; //ROM cache, NULL = every job starts cold
+    quirk_profiles quirks; //Profile of jobs that don't name one
+} pool;
+
+double elapsed_seconds(struct timespec *start, struct timespec *end){
+    return (end->tv_sec - start->tv_sec) + (end->tv_nsec - start->tv_nsec) / 1e9;
+}
+
+void usage(void){
+    printf("Usage: ./chip8-pool [--threads N] [--engine interpreter|block|jit] [--ips N] [--cache-dir DIR]\n"
+           "                    [--quirks default|vip|schip|xo] <job file>\n");
+    exit(1);
+}
+
+long parse_count(const char *arg){
+    char *end;
+    long value = strtol(arg, &end, 10);
+
+    if(*arg == '\0' || *end != '\0' || value <= 0){
+        printf("Invalid count: %s\n", arg);
+        exit(1);
+    }
+    return value;
+}
+
+void load_input_script(job *j){
+    FILE *script = fopen(j->script, "r");
+    char line[256];
+    size_t capacity = 0;
+    int line_number = 0;
+
+    if(script == NULL){
+        printf("Error opening input script %s\n", j->script);
+        exit(1);
+    }
+
+    while(fgets(line, sizeof line, script)){
+        unsigned long long frame;
+        unsigned key;
+        char action[8];
+
+        line_number++;
+        if(line[strspn(line, " \t\r\n")] == '\0' || line[strspn(line, " \t")] == '#'){
+            continue;
+        }
+
+        if(sscanf(line, "%llu %x %7s", &frame, &key, action) != 3 || key > 0xF
+           || (strcmp(action, "down") && strcmp(action, "up"))){
+            printf("%s:%d: expected <frame> <key 0-F> <down|up>\n", j->script, line_number);
+            exit(1);
+        }
+
+        if(j->event_count && frame < j->events[j->event_count - 1].frame){
+            printf("%s:%d: frames must not go backwards\n", j->script, line_number);
+            exit(1);
+        }
+
+        if(j->event_count == capacity){
+            capacity = capacity ? capacity * 2 : 64;
+            j->events = realloc(j->events, capacity * sizeof *j->events);
+            if(!j->events){
+                printf("Out of memory\n");
+                exit(1);
+            }
+        }
+
+        j->events[j->event_count].frame = frame;
+        j->events[j->event_count].key = key;
+        j->events[j->event_count].down = !strcmp(action, "down");
+        j->event_count++;
+    }
+
+    fclose(script);
+}
+
+void load_jobs(pool *p, const char *path){
+    FILE *file = fopen(path, "r");
+    char line[1024];
+    size_t capacity = 0;
+    int line_number = 0;
+
+    if(file == NULL){
+        printf("Error opening job file\n");
+        exit(1);
+    }
+
+    while(fgets(line, sizeof line, file)){
+        char rom[512], script[512], quirks[64];
+        long cycles;
+        unsigned long seed;
+
+        line_number++;
+        if(line[strspn(line, " \t\r\n")] == '\0' || line[strspn(line, " \t")] == '#'){
+            continue;
+        }
+
+        int fields = sscanf(line, "%511s %511s %ld %lu %63s", rom, script, &cycles, &seed, quirks);
+        if(fields < 3 || cycles <= 0){
+            printf("%s:%d: expected <rom> <input script or -> <cycles> [seed [quirk profile]]\n", path, line_number);
+            exit(1);
+        }
+        int profile = (fields == 5) ? quirk_profile_from_name(quirks) : (int)p->quirks;
+        if(profile < 0){
+            printf("%s:%d: unknown quirk profile %s\n", path, line_number, quirks);
+            exit(1);
+        }
+
+        if(p->job_count == capacity){
+            capacity = capacity ? capacity * 2 : 64;
+            p->jobs = realloc(p->jobs, capacity * sizeof *p->jobs);
+            if(!p->jobs){
+                printf("Out of memory\n");
+                exit(1);
+            }
+        }
+
+        job *j = &p->jobs[p->job_count++];
+        memset(j, 0, sizeof *j);
+        j->rom = strdup(rom);
+        j->script = strcmp(script, "-") ? strdup(script) : NULL;
+        j->cycles = cycles;
+        j->seed = (fields >= 4) ? (__uint32_t)seed : (__uint32_t)line_number;
+        j->quirks = profile;
+
+        if(j->script){
+            load_input_script(j);
+        }
+    }
+
+    fclose(file);
+
+    if(!p->job_count){
+        printf("No jobs in %s\n", path);
+        exit(1);
+    }
+}
+
+//FNV-1a over everything a ROM can observe, so runs can be compared across engines and builds
+__uint64_t hash_state(const chip8 *chip8_object_ptr){
+    __uint64_t hash = 0xCBF29CE484222325ULL;
+
+    hash = hash_bytes(hash, chip8_object_ptr->RAM, sizeof chip8_object_ptr->RAM);
+    hash = hash_bytes(hash, chip8_object_ptr->display, sizeof chip8_object_ptr->display);
+    hash = hash_bytes(hash, &chip8_object_ptr->hires, sizeof chip8_object_ptr->hires);
+    hash = hash_bytes(hash, &chip8_object_ptr->planes, sizeof chip8_object_ptr->planes);
+    hash = hash_bytes(hash, chip8_object_ptr->rpl, sizeof chip8_object_ptr->rpl);
+    hash = hash_bytes(hash, chip8_object_ptr->audio_pattern, sizeof chip8_object_ptr->audio_pattern);
+    hash = hash_bytes(hash, &chip8_object_ptr->pitch, sizeof chip8_object_ptr->pitch);
+    hash = hash_bytes(hash, chip8_object_ptr->registers, sizeof chip8_object_ptr->registers);
+    hash = hash_bytes(hash, chip8_object_ptr->stack, sizeof chip8_object_ptr->stack);
+    hash = hash_bytes(hash, &chip8_object_ptr->PC, sizeof chip8_object_ptr->PC);
+    hash = hash_bytes(hash, &chip8_object_ptr->I, sizeof chip8_object_ptr->I);
+    hash = hash_bytes(hash, &chip8_object_ptr->sp, sizeof chip8_object_ptr->sp);
+    hash = hash_bytes(hash, &chip8_object_ptr->delay_timer, sizeof chip8_object_ptr->delay_timer);
+    hash = hash_bytes(hash, &chip8_object_ptr->sound_timer, sizeof chip8_object_ptr->sound_timer);
+    return hash;
+}
+
+//Same frame structure as a headless run of the frontend, with key changes applied at frame starts
+void run_job(pool *p, job *j, chip8 *chip8_object_ptr){
+    struct timespec start, end;
+    FILE *rom = fopen(j->rom, "rb");
+    struct stat info;
+
+    if(rom == NULL){
+        j->failed = "cannot open ROM";
+        return;
+    }
+
+    //initialize_chip8() exits on a ROM it can't load, that would end every other job too
+    if(fstat(fileno(rom), &info) != 0 || !S_ISREG(info.st_mode)){
+        j->failed = "ROM is not a regular file";
+        fclose(rom);
+        return;
+    }
+    if(info.st_size > MAX_ROM_SIZE){
+        j->failed = "ROM too large";
+        fclose(rom);
+        return;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    initialize_chip8(chip8_object_ptr, rom);
+    fclose(rom);
+    set_quirks(chip8_object_ptr, j->quirks);
+    if(p->cache_directory) load_rom_cache(chip8_object_ptr, p->cache_directory);
+    set_engine(chip8_object_ptr, p->engine);
+    seed_chip8(chip8_object_ptr, j->seed);
+
+    size_t next_event = 0;
+    long cycles = 0;
+
+    while(!chip8_object_ptr->state && cycles < j->cycles){
+        while(next_event < j->event_count && j->events[next_event].frame <= chip8_object_ptr->frames){
+            set_key(chip8_object_ptr, j->events[next_event].key, j->events[next_event].down);
+            next_event++;
+        }
+
+        long batch = instructions_for_frame(chip8_object_ptr, p->ips);
+
+        //The budget can end the run in the middle of a frame
+        if(j->cycles - cycles < batch){
+            cycles += execute_instructions(chip8_object_ptr, j->cycles - cycles);
+            break;
+        }
+
+        cycles += execute_instructions(chip8_object_ptr, batch);
+        if(chip8_object_ptr->state) break;
+        end_frame(chip8_object_ptr);
+    }
+
+    j->instructions = cycles;
+    j->frames = chip8_object_ptr->frames;
+    j->hash = hash_state(chip8_object_ptr);
+
+    destroy_chip8(chip8_object_ptr);
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    j->seconds = elapsed_seconds(&start, &end);
+}
+
+//Next job for worker id, its own queue first, then the other queues; 0 when everything is taken
+int take_job(pool *p, int id, size_t *index, int *stolen){
+    job_queue *own = &p->queues[id];
+
+    pthread_mutex_lock(&own->lock);
+    if(own->head < own->tail){
+        *index = own->jobs[--own->tail];
+        pthread_mutex_unlock(&own->lock);
+        *stolen = 0;
+        return 1;
+    }
+    pthread_mutex_unlock(&own->lock);
+
+    //Jobs are never added after the start, so one empty pass over the victims means the pool is done
+    for(int i=1; i<p->threads; i++){
+        job_queue *victim = &p->queues[(id + i) % p->threads];
+
+        pthread_mutex_lock(&victim->lock);
+        if(victim->head < victim->tail){
+            *index = victim->jobs[victim->head++];
+            pthread_mutex_unlock(&victim->lock);
+            *stolen = 1;
+            return 1;
+        }
+        pthread_mutex_unlock(&victim->lock);
+    }
+    return 0;
+}
+
+void *worker_main(void *arg){
+    worker *w = arg;
+    pool *p = w->pool;
+    size_t index;
+    int stolen;
+
+    //Too big for a thread stack, and reused for every job this worker runs
+    chip8 *chip8_object_ptr = malloc(sizeof *chip8_object_ptr);
+    if(!chip8_object_ptr){
+        printf("Out of memory\n");
+        exit(1);
+    }
+
+    while(take_job(p, w->id, &index, &stolen)){
+        p->jobs[index].worker = w->id;
+        run_job(p, &p->jobs[index], chip8_object_ptr);
+        w->jobs_run++;
+        w->jobs_stolen += stolen;
+    }
+
+    free(chip8_object_ptr);
+    return NULL;
+}
+
+int main(int argc, char **argv){
+    pool p = {0};
+    const char *job_file = NULL;
+    long threads = sysconf(_SC_NPROCESSORS_ONLN);
+
+    p.engine = ENGINE_INTERPRETER;
+    p.ips = DEFAULT_IPS;
+
+    for(int i=1; i<argc; i++){
+        if(!strcmp(argv[i], "--threads") && i + 1 < argc){
+            threads = parse_count(argv[++i]);
+        }else if(!strcmp(argv[i], "--engine") && i + 1 < argc){
+            i++;
+            if(!strcmp(argv[i], "interpreter")){
+                p.engine = ENGINE_INTERPRETER;
+            }else if(!strcmp(argv[i], "block")){
+                p.engine = ENGINE_BLOCK;
+            }else if(!strcmp(argv[i], "jit")){
+                p.engine = ENGINE_JIT;
+            }else{
+                usage();
+            }
+        }else if(!strcmp(argv[i], "--ips") && i + 1 < argc){
+            p.ips = parse_count(argv[++i]);
+        }else if(!strcmp(argv[i], "--cache-dir") && i + 1 < argc){
+            p.cache_directory = argv[++i];
+        }else if(!strcmp(argv[i], "--quirks") && i + 1 < argc){
+            int quirks = quirk_profile_from_name(argv[++i]);
+            if(quirks < 0){
+                usage();
+            }
+            p.quirks = quirks;
+        }else if(argv[i][0] != '-' && !job_file){
+            job_file = argv[i];
+        }else{
+            usage();
+        }
+    }
+
+    if(!job_file){
+        usage();
+    }
+
+    load_jobs(&p, job_file);
+
+    //More threads than jobs would only spin on empty queues
+    if(threads < 1) threads = 1;
+    if((size_t)threads > p.job_count) threads = p.job_count;
+    p.threads = threads;
+
+    p.queues = calloc(p.threads, sizeof *p.queues);
+    p.workers = calloc(p.threads, sizeof *p.workers);
+    if(!p.queues || !p.workers){
+        printf("Out of memory\n");
+        exit(1);
+    }
+
+    for(int i=0; i<p.threads; i++){
+        pthread_mutex_init(&p.queues[i].lock, NULL);
+        p.queues[i].jobs = malloc((p.job_count / p.threads + 1) * sizeof *p.queues[i].jobs);
+        if(!p.queues[i].jobs){
+            printf("Out of memory\n");
+            exit(1);
+        }
+    }
+
+    //Deal in reverse so each owner, popping from the back, runs its jobs in file order
+    for(size_t i=p.job_count; i-- > 0;){
+        job_queue *q = &p.queues[i % p.threads];
+        q->jobs[q->tail++] = i;
+    }
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for(int i=0; i<p.threads; i++){
+        p.workers[i].pool = &p;
+        p.workers[i].id = i;
+        if(pthread_create(&p.workers[i].thread, NULL, worker_main, &p.workers[i]) != 0){
+            printf("Error creating worker thread\n");
+            exit(1);
+        }
+    }
+
+    for(int i=0; i<p.threads; i++){
+        pthread_join(p.workers[i].thread, NULL);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double seconds = elapsed_seconds(&start, &end);
+
+    //Per-job results in job file order, independent of which worker ran what
+    long total_instructions = 0;
+    __uint64_t total_frames = 0;
+    int failures = 0;
+
+    for(size_t i=0; i<p.job_count; i++){
+        job *j = &p.jobs[i];
+
+        if(j->failed){
+            printf("job=%zu rom=%s error=\"%s\"\n", i, j->rom, j->failed);
+            failures++;
+            continue;
+        }
+
+        printf("job=%zu rom=%s instructions=%ld frames=%llu hash=%016llx seconds=%.6f worker=%d\n",
+            i, j->rom, j->instructions, (unsigned long long)j->frames,
+            (unsigned long long)j->hash, j->seconds, j->worker);
+        total_instructions += j->instructions;
+        total_frames += j->frames;
+    }
+
+    for(int i=0; i<p.threads; i++){
+        printf("worker=%d jobs=%ld stolen=%ld\n", i, p.workers[i].jobs_run, p.workers[i].jobs_stolen);
+    }
+
+    printf("jobs=%zu failed=%d threads=%d instructions=%ld frames=%llu seconds=%.6f mips=%.2f\n",
+        p.job_count, failures, p.threads, total_instructions, (unsigned long long)total_frames,
+        seconds, seconds > 0 ? total_instructions / seconds / 1e6 : 0.0);
+
+    for(size_t i=0; i<p.job_count; i++){
+        free(p.jobs[i].rom);
+        free(p.jobs[i].script);
+        free(p.jobs[i].events);
+    }
+    for(int i=0; i<p.threads; i++){
+        pthread_mutex_destroy(&p.queues[i].lock);
+        free(p.queues[i].jobs);
+    }
+    free(p.queues);
+    free(p.workers);
+    free(p.jobs);
+
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,183 @@
+#include <stdlib.h>
+#include <string.h>
+#include "chip8.h"
+
+/*
+Runtime counters. When chip8->profile is set every engine counts each
+executed instruction by opcode class and by address: the interpreter per
+instruction, the block engine and the JIT once per block run, for all the
+instructions the run covered. Dxyn collisions and Fx0A spins (executions
+that are still waiting for a key) are counted by their handlers. With the
+profile pointer left NULL the cost is one predictable branch per dispatch.
+*/
+
+//Addresses listed in the report
+#define PROFILE_TOP_ADDRESSES 32
+
+static const char *class_names[OPCODE_CLASSES] = {
+    [CLASS_00E0] = "00E0", [CLASS_00EE] = "00EE", [CLASS_0NNN] = "0NNN",
+    [CLASS_1NNN] = "1NNN", [CLASS_2NNN] = "2NNN", [CLASS_3XNN] = "3XNN",
+    [CLASS_4XNN] = "4XNN", [CLASS_5XY0] = "5XY0", [CLASS_6XNN] = "6XNN",
+    [CLASS_7XNN] = "7XNN", [CLASS_8XY0] = "8XY0", [CLASS_8XY1] = "8XY1",
+    [CLASS_8XY2] = "8XY2", [CLASS_8XY3] = "8XY3", [CLASS_8XY4] = "8XY4",
+    [CLASS_8XY5] = "8XY5", [CLASS_8XY6] = "8XY6", [CLASS_8XY7] = "8XY7",
+    [CLASS_8XYE] = "8XYE", [CLASS_9XY0] = "9XY0", [CLASS_ANNN] = "ANNN",
+    [CLASS_BNNN] = "BNNN", [CLASS_CXNN] = "CXNN", [CLASS_DXYN] = "DXYN",
+    [CLASS_EX9E] = "EX9E", [CLASS_EXA1] = "EXA1", [CLASS_FX07] = "FX07",
+    [CLASS_FX0A] = "FX0A", [CLASS_FX15] = "FX15", [CLASS_FX18] = "FX18",
+    [CLASS_FX1E] = "FX1E", [CLASS_FX29] = "FX29", [CLASS_FX33] = "FX33",
+    [CLASS_FX55] = "FX55", [CLASS_FX65] = "FX65", [CLASS_00CN] = "00CN",
+    [CLASS_00DN] = "00DN", [CLASS_00FB] = "00FB", [CLASS_00FC] = "00FC", [CLASS_00FD] = "00FD",
+    [CLASS_00FE] = "00FE", [CLASS_00FF] = "00FF", [CLASS_FX30] = "FX30",
+    [CLASS_FX75] = "FX75", [CLASS_FX85] = "FX85", [CLASS_F000] = "F000",
+    [CLASS_FN01] = "FN01", [CLASS_F002] = "F002", [CLASS_FX3A] = "FX3A",
+    [CLASS_5XY2] = "5XY2", [CLASS_5XY3] = "5XY3", [CLASS_OTHER] = "other",
+};
+
+opcode_classes opcode_class(__uint16_t ins){
+    switch(first_nible){
+        case 0x0:
+            if(ins == 0x00e0) return CLASS_00E0;
+            if(ins == 0x00ee) return CLASS_00EE;
+            if((ins & 0xfff0) == 0x00c0) return CLASS_00CN;
+            if((ins & 0xfff0) == 0x00d0) return CLASS_00DN;
+            if(ins == 0x00fb) return CLASS_00FB;
+            if(ins == 0x00fc) return CLASS_00FC;
+            if(ins == 0x00fd) return CLASS_00FD;
+            if(ins == 0x00fe) return CLASS_00FE;
+            if(ins == 0x00ff) return CLASS_00FF;
+            return CLASS_0NNN;
+        case 0x5:
+            if(fourth_nible == 0x2) return CLASS_5XY2;
+            if(fourth_nible == 0x3) return CLASS_5XY3;
+            return CLASS_5XY0;
+        case 0x8:
+            switch(fourth_nible){
+                case 0x0: return CLASS_8XY0;
+                case 0x1: return CLASS_8XY1;
+                case 0x2: return CLASS_8XY2;
+                case 0x3: return CLASS_8XY3;
+                case 0x4: return CLASS_8XY4;
+                case 0x5: return CLASS_8XY5;
+                case 0x6: return CLASS_8XY6;
+                case 0x7: return CLASS_8XY7;
+                case 0xE: return CLASS_8XYE;
+            }
+            return CLASS_OTHER;
+        case 0x9:
+            return CLASS_9XY0;
+        case 0xE:
+            return ((ins & 0xff) == 0x9e) ? CLASS_EX9E : CLASS_EXA1;
+        case 0xF:
+            if(ins == 0xf000) return CLASS_F000;
+            switch(ins & 0xff){
+                case 0x01: return CLASS_FN01;
+                case 0x02: return CLASS_F002;
+                case 0x07: return CLASS_FX07;
+                case 0x0A: return CLASS_FX0A;
+                case 0x15: return CLASS_FX15;
+                case 0x18: return CLASS_FX18;
+                case 0x1E: return CLASS_FX1E;
+                case 0x29: return CLASS_FX29;
+                case 0x30: return CLASS_FX30;
+                case 0x33: return CLASS_FX33;
+                case 0x3A: return CLASS_FX3A;
+                case 0x55: return CLASS_FX55;
+                case 0x65: return CLASS_FX65;
+                case 0x75: return CLASS_FX75;
+                case 0x85: return CLASS_FX85;
+            }
+            return CLASS_OTHER;
+    }
+
+    //The remaining groups are one class each, in opcode order
+    static const opcode_classes groups[16] = {
+        [0x1] = CLASS_1NNN, [0x2] = CLASS_2NNN, [0x3] = CLASS_3XNN, [0x4] = CLASS_4XNN,
+        [0x6] = CLASS_6XNN, [0x7] = CLASS_7XNN, [0xA] = CLASS_ANNN, [0xB] = CLASS_BNNN,
+        [0xC] = CLASS_CXNN, [0xD] = CLASS_DXYN,
+    };
+    return groups[first_nible];
+}
+
+void enable_profile(chip8 *chip8_object_ptr){
+    if(chip8_object_ptr->profile) return;
+
+    chip8_object_ptr->profile = calloc(1, sizeof(profile));
+    if(!chip8_object_ptr->profile){
+        printf("Error allocating profile\n");
+        exit(1);
+    }
+}
+
+void destroy_profile(chip8 *chip8_object_ptr){
+    free(chip8_object_ptr->profile);
+    chip8_object_ptr->profile = NULL;
+}
+
+void profile_block(profile *profile_ptr, const instruction *ops, __uint16_t start, long count){
+    for(long i=0; i<count; i++){
+        profile_ptr->class_counts[ops[i].opclass]++;
+        profile_ptr->address_counts[(start + 2 * i) & (RAM_SIZE - 1)]++;
+    }
+}
+
+//qsort() has no context argument, the arrays being sorted are indices into this
+static const __uint64_t *sort_counts;
+
+static int by_count(const void *a, const void *b){
+    __uint64_t count_a = sort_counts[*(const int *)a];
+    __uint64_t count_b = sort_counts[*(const int *)b];
+
+    if(count_a != count_b) return (count_a < count_b) ? 1 : -1;
+    return *(const int *)a - *(const int *)b;
+}
+
+void print_profile(FILE *out, const chip8 *chip8_object_ptr){
+    const profile *profile_ptr = chip8_object_ptr->profile;
+    int classes[OPCODE_CLASSES];
+    static int addresses[RAM_SIZE];
+    __uint64_t total = 0;
+
+    if(!profile_ptr) return;
+
+    for(int i=0; i<OPCODE_CLASSES; i++){
+        classes[i] = i;
+        total += profile_ptr->class_counts[i];
+    }
+    for(int i=0; i<RAM_SIZE; i++){
+        addresses[i] = i;
+    }
+
+    fprintf(out, "Profile after %llu instructions, %llu frames\n",
+        (unsigned long long)total, (unsigned long long)chip8_object_ptr->frames);
+    fprintf(out, "Dxyn collisions: %llu\n", (unsigned long long)profile_ptr->collisions);
+    fprintf(out, "Fx0A wait spins: %llu\n", (unsigned long long)profile_ptr->key_wait_spins);
+    fprintf(out, "Idle loop instructions skipped: %llu\n", (unsigned long long)profile_ptr->idle_skipped);
+
+    sort_counts = profile_ptr->class_counts;
+    qsort(classes, OPCODE_CLASSES, sizeof classes[0], by_count);
+
+    fprintf(out, "Opcode classes:\n");
+    for(int i=0; i<OPCODE_CLASSES; i++){
+        __uint64_t count = profile_ptr->class_counts[classes[i]];
+        if(!count) break;
+        fprintf(out, "  %-5s %14llu %6.2f%%\n", class_names[classes[i]],
+            (unsigned long long)count, 100.0 * count / total);
+    }
+
+    sort_counts = profile_ptr->address_counts;
+    qsort(addresses, RAM_SIZE, sizeof addresses[0], by_count);
+
+    fprintf(out, "Hottest addresses:\n");
+    for(int i=0; i<PROFILE_TOP_ADDRESSES; i++){
+        __uint64_t count = profile_ptr->address_counts[addresses[i]];
+        if(!count) break;
+
+        //The opcode there now, self-modifying code may have run others at the same address
+        __uint16_t opcode = (chip8_object_ptr->RAM[addresses[i]] << 8)
+                          | chip8_object_ptr->RAM[(addresses[i] + 1) & (RAM_SIZE - 1)];
+        fprintf(out, "  0x%04X %04X %14llu %6.2f%%\n", addresses[i], opcode,
+            (unsigned long long)count, 100.0 * count / total);
+    }
+    fflush(out);
+}
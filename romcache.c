@@ -0,0 +1,259 @@
+#define _DEFAULT_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "chip8.h"
+
+/*
+On-disk cache of what is known about a ROM before it runs: the code
+reachable from PROGRAM_START (the same control flow walk chip8-aot does,
+see instruction_successors()) and every one of those instructions
+decoded. Files are named after an FNV-1a hash of the ROM and the quirk
+profile it was decoded for (the profile picks the handlers) and hold the ROM
+itself, so a hash collision is caught, plus a hash of handler_names, so a
+build that decodes differently (new opcodes, reordered handlers) rebuilds
+them instead of reading indices it would misinterpret. A valid file is
+mapped and copied into chip8->decoded, the engines start with every
+reachable instruction decoded; anything else (wrong version, other ROM,
+truncated file) is replaced. Files are written under a temporary name and
+renamed, so concurrent runs of the same ROM only ever see complete ones.
+*/
+
+//FNV-1a, cheap and good enough to tell ROMs and machine states apart
+__uint64_t hash_bytes(__uint64_t hash, const void *data, size_t len){
+    const __uint8_t *bytes = data;
+
+    for(size_t i=0; i<len; i++){
+        hash ^= bytes[i];
+        hash *= 0x100000001B3ULL;
+    }
+    return hash;
+}
+
+//The table's order is part of the cache format
+static __uint64_t handler_table_hash(void){
+    __uint64_t hash = 0xCBF29CE484222325ULL;
+
+    for(size_t i=0; i<handler_count; i++){
+        hash = hash_bytes(hash, handler_names[i].name, strlen(handler_names[i].name) + 1);
+    }
+    return hash;
+}
+
+//Index of handler in handler_names, -1 if it isn't there
+int handler_index(handler_fn handler){
+    for(size_t i=0; i<handler_count; i++){
+        if(handler_names[i].handler == handler) return i;
+    }
+    return -1;
+}
+
+//Where execution can continue after the instruction at address, targets only known at run time aren't listed
+int instruction_successors(chip8 *chip8_object_ptr, int address, int *next){
+    const instruction *ins = decode_instruction(chip8_object_ptr, address);
+    handler_fn handler = ins->handler;
+
+    if(handler == set_pc){
+        next[0] = ins->nnn;
+        return 1;
+    }
+    if(handler == call_subroutine){
+        next[0] = ins->nnn;
+        next[1] = address + 2;
+        return 2;
+    }
+    if(handler == return_from_subroutine || handler == jump_with_offset){
+        return 0;
+    }
+    if(handler == skip_constant_equal || handler == skip_not_constant_equal ||
+       handler == skip_register_equal || handler == skip_register_not_equal ||
+       handler == skip_if_key || handler == skip_if_not_key){
+        //Skipping an F000 NNNN steps over its address word too, see skip_length()
+        int skipped = (decode_instruction(chip8_object_ptr, address + 2)->opcode == 0xF000) ? 4 : 2;
+
+        next[0] = address + 2;
+        next[1] = address + 2 + skipped;
+        return 2;
+    }
+    if(handler == long_index){
+        next[0] = address + 4;
+        return 1;
+    }
+    if(handler == get_key){
+        next[0] = address;
+        next[1] = address + 2;
+        return 2;
+    }
+
+    next[0] = address + 2;
+    return 1;
+}
+
+/*
+Marks every instruction address in the ROM reachable from PROGRAM_START,
+returns how many there are. Code outside the ROM (the fonts, zeroed RAM
+a wild jump lands in) isn't followed, it's decoded when it runs.
+*/
+static long find_code(chip8 *chip8_object_ptr, __uint8_t *code){
+    __uint16_t *pending = malloc(RAM_SIZE * sizeof *pending);
+    long pending_count = 0;
+    long count = 0;
+    int end = PROGRAM_START + chip8_object_ptr->rom_size - 1; //Last byte of the ROM, an instruction has to start before it
+
+    if(!pending){
+        printf("Error allocating ROM analysis\n");
+        exit(1);
+    }
+
+    if(end <= PROGRAM_START){
+        free(pending);
+        return 0;
+    }
+
+    pending[pending_count++] = PROGRAM_START;
+    code[PROGRAM_START] = 1;
+
+    while(pending_count){
+        __uint16_t address = pending[--pending_count];
+        int next[2];
+
+        count++;
+
+        int successors = instruction_successors(chip8_object_ptr, address, next);
+        for(int i=0; i<successors; i++){
+            if(next[i] < PROGRAM_START || next[i] >= end || code[next[i]]) continue;
+            code[next[i]] = 1;
+            pending[pending_count++] = next[i];
+        }
+    }
+
+    free(pending);
+    return count;
+}
+
+static void cache_path(char *out, size_t size, const char *directory, __uint64_t hash, quirk_profiles quirks){
+    snprintf(out, size, "%s/%016llx-%s.c8cache", directory, (unsigned long long)hash, quirk_profile_name(quirks));
+}
+
+//1 if the file at path is a complete cache for this ROM and build, then chip8->decoded holds its instructions
+static int read_cache(chip8 *chip8_object_ptr, const char *path, __uint64_t rom_hash){
+    int fd = open(path, O_RDONLY);
+    struct stat info;
+
+    if(fd < 0) return 0;
+    if(fstat(fd, &info) != 0 || (size_t)info.st_size < sizeof(rom_cache_header)){
+        close(fd);
+        return 0;
+    }
+
+    size_t size = info.st_size;
+    const __uint8_t *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(map == MAP_FAILED) return 0;
+
+    const rom_cache_header *header = (const rom_cache_header *)map;
+    const __uint8_t *rom = map + sizeof *header;
+    int valid = !memcmp(header->magic, "C8RC", 4)
+             && header->version == ROM_CACHE_VERSION
+             && header->handler_hash == handler_table_hash()
+             && header->rom_hash == rom_hash
+             && header->quirks == chip8_object_ptr->quirks
+             && header->rom_size == chip8_object_ptr->rom_size
+             && header->instruction_count <= RAM_SIZE
+             && size == sizeof *header + header->rom_size + header->instruction_count * sizeof(cached_instruction)
+             && !memcmp(rom, chip8_object_ptr->RAM + PROGRAM_START, header->rom_size);
+    //The records follow a ROM of any length, they're copied out rather than read in place where they may be misaligned
+    const __uint8_t *instructions = rom + chip8_object_ptr->rom_size;
+    cached_instruction cached;
+
+    for(__uint32_t i=0; valid && i<header->instruction_count; i++){
+        memcpy(&cached, instructions + i * sizeof cached, sizeof cached);
+        valid = cached.handler < handler_count && cached.opclass < OPCODE_CLASSES;
+    }
+
+    for(__uint32_t i=0; valid && i<header->instruction_count; i++){
+        memcpy(&cached, instructions + i * sizeof cached, sizeof cached);
+
+        chip8_object_ptr->decoded[cached.address] = (instruction){
+            handler_names[cached.handler].handler, cached.opcode, cached.nnn, cached.nn,
+            cached.n, cached.x, cached.y, cached.opclass,
+        };
+    }
+
+    munmap((void *)map, size);
+    return valid;
+}
+
+//Writes the cache for the instructions find_code() marked, they are all decoded by then
+static void write_cache(chip8 *chip8_object_ptr, const char *path, __uint64_t rom_hash, const __uint8_t *code, long count){
+    char temporary[4096];
+    rom_cache_header header = {
+        .magic = {'C', '8', 'R', 'C'},
+        .version = ROM_CACHE_VERSION,
+        .handler_hash = handler_table_hash(),
+        .rom_hash = rom_hash,
+        .rom_size = chip8_object_ptr->rom_size,
+        .instruction_count = count,
+        .quirks = chip8_object_ptr->quirks,
+    };
+
+    //A cache that can't be written costs the next run its warm start, nothing more
+    if(snprintf(temporary, sizeof temporary, "%s.XXXXXX", path) >= (int)sizeof temporary) return;
+    int fd = mkstemp(temporary);
+    if(fd < 0) return;
+
+    FILE *file = fdopen(fd, "wb");
+    if(!file){
+        close(fd);
+        unlink(temporary);
+        return;
+    }
+
+    int ok = fwrite(&header, sizeof header, 1, file) == 1
+          && fwrite(chip8_object_ptr->RAM + PROGRAM_START, 1, header.rom_size, file) == header.rom_size;
+
+    for(long address=0; ok && address<RAM_SIZE; address++){
+        if(!code[address]) continue;
+
+        const instruction *ins = &chip8_object_ptr->decoded[address];
+        cached_instruction cached = {
+            address, ins->opcode, ins->nnn, ins->nn, ins->n, ins->x, ins->y, ins->opclass,
+            handler_index(ins->handler),
+        };
+        ok = fwrite(&cached, sizeof cached, 1, file) == 1;
+    }
+
+    if(fclose(file) != 0 || !ok || rename(temporary, path) != 0){
+        unlink(temporary);
+    }
+}
+
+/*
+Call right after initialize_chip8() and set_quirks(). Returns 1 when a
+valid cache for the loaded ROM and profile was found in directory, 0 when
+the ROM was analysed and the cache (re)written; either way every
+reachable instruction is decoded.
+*/
+int load_rom_cache(chip8 *chip8_object_ptr, const char *directory){
+    char path[4096];
+    __uint64_t rom_hash = hash_bytes(0xCBF29CE484222325ULL, chip8_object_ptr->RAM + PROGRAM_START, chip8_object_ptr->rom_size);
+
+    cache_path(path, sizeof path, directory, rom_hash, chip8_object_ptr->quirks);
+    if(read_cache(chip8_object_ptr, path, rom_hash)) return 1;
+
+    __uint8_t *code = calloc(RAM_SIZE, 1);
+    if(!code){
+        printf("Error allocating ROM analysis\n");
+        exit(1);
+    }
+
+    long count = find_code(chip8_object_ptr, code);
+    write_cache(chip8_object_ptr, path, rom_hash, code, count);
+
+    free(code);
+    return 0;
+}
@@ -0,0 +1,400 @@
+#include <stdlib.h>
+#include <string.h>
+#include "chip8.h"
+
+/*
+Savestates and the rewind buffer. A machine_state is a plain copy of what
+a ROM can observe; loading one back only invalidates the decoded/translated
+code for RAM that actually differs, so stepping back a frame at a time
+doesn't throw away the engines' caches.
+
+The rewind buffer keeps one snapshot per frame in a fixed-size byte ring.
+Every REWIND_KEYFRAME_INTERVAL frames a keyframe is stored, the frames in
+between are stored as the XOR against that keyframe, run-length encoded,
+which is a few dozen bytes for most frames. Keyframes are encoded the same
+way against an all-zero state. Restoring any snapshot decodes at most two
+entries. When the ring is full the oldest keyframe goes, together with
+the deltas that depend on it.
+*/
+
+//Snapshots between two keyframes, including the keyframe
+#define REWIND_KEYFRAME_INTERVAL 60
+
+#define STATE_FILE_VERSION 3
+
+typedef struct rewind_entry{
+    size_t offset; //Start of the encoded snapshot in data
+    size_t size; //Encoded bytes
+    __uint64_t keyframe; //Sequence number of the keyframe it was encoded against, its own for keyframes
+} rewind_entry;
+
+typedef struct rewind_buffer{
+    __uint8_t *data; //Encoded snapshots, used as a ring
+    size_t capacity; //Bytes in data
+    rewind_entry *entries; //Ring of entries, oldest at first
+    size_t max_entries;
+    size_t first;
+    size_t count;
+    __uint64_t first_sequence; //Sequence number of entries[first]
+    int have_base; //base holds the decoded keyframe of the newest group
+    machine_state base; //Keyframe new deltas are encoded against
+    machine_state snapshot; //Scratch for the state being pushed or restored
+    __uint8_t *scratch; //Worst case encoding of one snapshot
+    size_t scratch_size;
+} rewind_buffer;
+
+void save_state(const chip8 *chip8_object_ptr, machine_state *state){
+    //Padding is zeroed too, so identical machines give identical bytes and empty deltas
+    memset(state, 0, sizeof *state);
+
+    memcpy(state->RAM, chip8_object_ptr->RAM, sizeof state->RAM);
+    memcpy(state->display, chip8_object_ptr->display, sizeof state->display);
+    state->hires = chip8_object_ptr->hires;
+    state->planes = chip8_object_ptr->planes;
+    state->PC = chip8_object_ptr->PC;
+    state->I = chip8_object_ptr->I;
+    memcpy(state->stack, chip8_object_ptr->stack, sizeof state->stack);
+    state->sp = chip8_object_ptr->sp;
+    memcpy(state->registers, chip8_object_ptr->registers, sizeof state->registers);
+    memcpy(state->rpl, chip8_object_ptr->rpl, sizeof state->rpl);
+    memcpy(state->audio_pattern, chip8_object_ptr->audio_pattern, sizeof state->audio_pattern);
+    state->audio_pattern_loaded = chip8_object_ptr->audio_pattern_loaded;
+    state->pitch = chip8_object_ptr->pitch;
+    state->delay_timer = chip8_object_ptr->delay_timer;
+    state->sound_timer = chip8_object_ptr->sound_timer;
+    state->key_waiting = chip8_object_ptr->key_waiting;
+    state->waited_key = chip8_object_ptr->waited_key;
+    state->rng_state = chip8_object_ptr->rng_state;
+    state->frames = chip8_object_ptr->frames;
+}
+
+void load_state(chip8 *chip8_object_ptr, const machine_state *state){
+    //Only RAM that changed has to be decoded/translated again
+    for(int i=0; i<RAM_SIZE; i++){
+        if(chip8_object_ptr->RAM[i] == state->RAM[i]) continue;
+
+        int start = i;
+        while(i < RAM_SIZE && chip8_object_ptr->RAM[i] != state->RAM[i]){
+            chip8_object_ptr->RAM[i] = state->RAM[i];
+            i++;
+        }
+        ram_written(chip8_object_ptr, start, i - start);
+    }
+
+    memcpy(chip8_object_ptr->display, state->display, sizeof state->display);
+    chip8_object_ptr->hires = state->hires;
+    chip8_object_ptr->planes = state->planes;
+    chip8_object_ptr->PC = state->PC;
+    chip8_object_ptr->I = state->I;
+    memcpy(chip8_object_ptr->stack, state->stack, sizeof state->stack);
+    chip8_object_ptr->sp = state->sp;
+    memcpy(chip8_object_ptr->registers, state->registers, sizeof state->registers);
+    memcpy(chip8_object_ptr->rpl, state->rpl, sizeof state->rpl);
+    memcpy(chip8_object_ptr->audio_pattern, state->audio_pattern, sizeof state->audio_pattern);
+    chip8_object_ptr->audio_pattern_loaded = state->audio_pattern_loaded;
+    chip8_object_ptr->pitch = state->pitch;
+    chip8_object_ptr->delay_timer = state->delay_timer;
+    chip8_object_ptr->sound_timer = state->sound_timer;
+    chip8_object_ptr->key_waiting = state->key_waiting;
+    chip8_object_ptr->waited_key = state->waited_key;
+    chip8_object_ptr->rng_state = state->rng_state;
+    chip8_object_ptr->frames = state->frames;
+    chip8_object_ptr->beeping = state->sound_timer > 0;
+    chip8_object_ptr->state = RUNNING;
+
+    mark_display_dirty(chip8_object_ptr, 0, SCREEN_HEIGHT(chip8_object_ptr) - 1);
+}
+
+/*
+State files are the raw machine_state behind a small header, so they are
+only portable between builds with the same struct layout; the size in the
+header catches the cases where it isn't.
+*/
+int write_state_file(const chip8 *chip8_object_ptr, const char *path){
+    machine_state state;
+    __uint32_t header[2] = {STATE_FILE_VERSION, sizeof state};
+    FILE *file = fopen(path, "wb");
+
+    if(file == NULL) return 0;
+
+    save_state(chip8_object_ptr, &state);
+
+    int ok = fwrite("C8ST", 1, 4, file) == 4
+          && fwrite(header, sizeof header, 1, file) == 1
+          && fwrite(&state, sizeof state, 1, file) == 1;
+
+    return (fclose(file) == 0) && ok;
+}
+
+int read_state_file(chip8 *chip8_object_ptr, const char *path){
+    machine_state state;
+    char magic[4];
+    __uint32_t header[2];
+    FILE *file = fopen(path, "rb");
+
+    if(file == NULL) return 0;
+
+    int ok = fread(magic, 1, 4, file) == 4 && !memcmp(magic, "C8ST", 4)
+          && fread(header, sizeof header, 1, file) == 1
+          && header[0] == STATE_FILE_VERSION && header[1] == sizeof state
+          && fread(&state, sizeof state, 1, file) == 1;
+
+    fclose(file);
+
+    if(ok){
+        load_state(chip8_object_ptr, &state);
+    }
+    return ok;
+}
+
+static size_t put_varint(__uint8_t *out, size_t value){
+    size_t len = 0;
+
+    while(value >= 0x80){
+        out[len++] = (value & 0x7f) | 0x80;
+        value >>= 7;
+    }
+    out[len++] = value;
+    return len;
+}
+
+static size_t get_varint(const __uint8_t *in, size_t *value){
+    size_t len = 0;
+    int shift = 0;
+
+    *value = 0;
+    do{
+        *value |= (size_t)(in[len] & 0x7f) << shift;
+        shift += 7;
+    }while(in[len++] & 0x80);
+    return len;
+}
+
+/*
+XOR of state against base as (zero run, literal length, literal bytes)
+triples, literal runs end at the first pair of zero bytes so isolated
+zeros don't cost a new triple.
+*/
+static size_t encode_delta(const machine_state *state, const machine_state *base, __uint8_t *out){
+    const __uint8_t *a = (const __uint8_t *)state;
+    const __uint8_t *b = (const __uint8_t *)base;
+    size_t size = sizeof *state;
+    size_t i = 0;
+    size_t len = 0;
+
+    while(i < size){
+        size_t zeros = 0;
+        while(i + zeros < size && a[i + zeros] == b[i + zeros]) zeros++;
+        i += zeros;
+        if(i == size) break;
+
+        size_t literal = 0;
+        while(i + literal < size){
+            if(a[i + literal] == b[i + literal]
+               && (i + literal + 1 == size || a[i + literal + 1] == b[i + literal + 1])) break;
+            literal++;
+        }
+
+        len += put_varint(out + len, zeros);
+        len += put_varint(out + len, literal);
+        for(size_t j=0; j<literal; j++){
+            out[len++] = a[i + j] ^ b[i + j];
+        }
+        i += literal;
+    }
+    return len;
+}
+
+//state must already hold the base
+static void apply_delta(machine_state *state, const __uint8_t *in, size_t len){
+    __uint8_t *a = (__uint8_t *)state;
+    size_t i = 0;
+    size_t pos = 0;
+
+    while(pos < len){
+        size_t zeros, literal;
+
+        pos += get_varint(in + pos, &zeros);
+        pos += get_varint(in + pos, &literal);
+        i += zeros;
+        for(size_t j=0; j<literal; j++){
+            a[i++] ^= in[pos++];
+        }
+    }
+}
+
+rewind_buffer *create_rewind_buffer(long seconds, size_t budget){
+    rewind_buffer *buffer = calloc(1, sizeof(rewind_buffer));
+
+    if(!buffer){
+        printf("Error allocating rewind buffer\n");
+        exit(1);
+    }
+
+    //Worst case: every byte is a literal, one triple per two bytes
+    buffer->scratch_size = sizeof(machine_state) / 2 * 4 + sizeof(machine_state) + 16;
+    buffer->capacity = budget;
+    buffer->max_entries = seconds * TIMER_HZ;
+
+    //At least one keyframe always has to fit
+    if(buffer->capacity < buffer->scratch_size){
+        buffer->capacity = buffer->scratch_size;
+    }
+
+    buffer->data = malloc(buffer->capacity);
+    buffer->entries = malloc(buffer->max_entries * sizeof(rewind_entry));
+    buffer->scratch = malloc(buffer->scratch_size);
+    if(!buffer->data || !buffer->entries || !buffer->scratch){
+        printf("Error allocating rewind buffer\n");
+        exit(1);
+    }
+
+    return buffer;
+}
+
+void destroy_rewind_buffer(rewind_buffer *buffer){
+    if(!buffer) return;
+
+    free(buffer->data);
+    free(buffer->entries);
+    free(buffer->scratch);
+    free(buffer);
+}
+
+static rewind_entry *entry_at(rewind_buffer *buffer, size_t i){
+    return &buffer->entries[(buffer->first + i) % buffer->max_entries];
+}
+
+//Drops the oldest keyframe and the deltas encoded against it
+static void drop_oldest_group(rewind_buffer *buffer){
+    do{
+        buffer->first = (buffer->first + 1) % buffer->max_entries;
+        buffer->first_sequence++;
+        buffer->count--;
+    }while(buffer->count && entry_at(buffer, 0)->keyframe != buffer->first_sequence);
+
+    if(!buffer->count){
+        buffer->have_base = 0;
+    }
+}
+
+void rewind_push(rewind_buffer *buffer, const chip8 *chip8_object_ptr){
+    __uint64_t sequence = buffer->first_sequence + buffer->count;
+    __uint64_t keyframe = sequence;
+    size_t size;
+
+    save_state(chip8_object_ptr, &buffer->snapshot);
+
+    if(buffer->have_base && buffer->count && sequence - entry_at(buffer, buffer->count - 1)->keyframe < REWIND_KEYFRAME_INTERVAL){
+        keyframe = entry_at(buffer, buffer->count - 1)->keyframe;
+    }
+
+    if(keyframe == sequence){
+        static const machine_state zero;
+        size = encode_delta(&buffer->snapshot, &zero, buffer->scratch);
+    }else{
+        size = encode_delta(&buffer->snapshot, &buffer->base, buffer->scratch);
+    }
+
+    if(buffer->count == buffer->max_entries){
+        drop_oldest_group(buffer);
+    }
+
+    //Entries are laid out back to back, a snapshot that doesn't fit before the end starts over at 0
+    size_t offset = 0;
+    if(buffer->count){
+        rewind_entry *newest = entry_at(buffer, buffer->count - 1);
+        offset = newest->offset + newest->size;
+        if(offset + size > buffer->capacity){
+            offset = 0;
+        }
+    }
+
+    while(buffer->count){
+        rewind_entry *oldest = entry_at(buffer, 0);
+        if(oldest->offset >= offset + size || offset >= oldest->offset + oldest->size) break;
+        drop_oldest_group(buffer);
+    }
+
+    //Making room took the keyframe this delta was encoded against, store a keyframe instead
+    if(keyframe != sequence && (!buffer->count || keyframe < buffer->first_sequence)){
+        static const machine_state zero;
+
+        buffer->first = 0;
+        buffer->count = 0;
+        buffer->first_sequence = sequence;
+        keyframe = sequence;
+        offset = 0;
+        size = encode_delta(&buffer->snapshot, &zero, buffer->scratch);
+    }
+
+    memcpy(buffer->data + offset, buffer->scratch, size);
+
+    if(!buffer->count){
+        buffer->first_sequence = sequence;
+    }
+
+    rewind_entry *entry = entry_at(buffer, buffer->count);
+    entry->offset = offset;
+    entry->size = size;
+    entry->keyframe = keyframe;
+    buffer->count++;
+
+    if(keyframe == sequence){
+        memcpy(&buffer->base, &buffer->snapshot, sizeof buffer->base);
+        buffer->have_base = 1;
+    }
+}
+
+//The newest snapshot is the current state, stepping drops it and goes back to the one before
+int rewind_step(rewind_buffer *buffer, chip8 *chip8_object_ptr){
+    if(buffer->count < 2) return 0;
+
+    rewind_entry *dropped = entry_at(buffer, buffer->count - 1);
+    buffer->count--;
+
+    //Dropping a keyframe leaves the previous group on top, its keyframe gets decoded below
+    if(dropped->keyframe == buffer->first_sequence + buffer->count){
+        buffer->have_base = 0;
+    }
+
+    rewind_entry *entry = entry_at(buffer, buffer->count - 1);
+    __uint64_t sequence = buffer->first_sequence + buffer->count - 1;
+
+    if(entry->keyframe == sequence){
+        memset(&buffer->snapshot, 0, sizeof buffer->snapshot);
+    }else{
+        //The newest group's keyframe is normally kept decoded in base
+        if(!buffer->have_base){
+            rewind_entry *key = entry_at(buffer, entry->keyframe - buffer->first_sequence);
+
+            memset(&buffer->base, 0, sizeof buffer->base);
+            apply_delta(&buffer->base, buffer->data + key->offset, key->size);
+            buffer->have_base = 1;
+        }
+        memcpy(&buffer->snapshot, &buffer->base, sizeof buffer->snapshot);
+    }
+    apply_delta(&buffer->snapshot, buffer->data + entry->offset, entry->size);
+
+    //A keyframe on top is its own base for the deltas pushed after it
+    if(entry->keyframe == sequence){
+        memcpy(&buffer->base, &buffer->snapshot, sizeof buffer->base);
+        buffer->have_base = 1;
+    }
+
+    load_state(chip8_object_ptr, &buffer->snapshot);
+    return 1;
+}
+
+size_t rewind_memory_used(rewind_buffer *buffer){
+    size_t used = 0;
+
+    for(size_t i=0; i<buffer->count; i++){
+        used += entry_at(buffer, i)->size;
+    }
+    return used;
+}
+
+size_t rewind_frames(const rewind_buffer *buffer){
+    return buffer->count;
+}
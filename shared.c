@@ -0,0 +1,225 @@
+#define _DEFAULT_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "chip8.h"
+
+/*
+Live state export for other processes (monitors, bots). With --export NAME
+the emulator creates the POSIX shared memory object /NAME holding one
+shared_segment and, once per frame, copies the display, registers, timers
+and frame counter into it under a seqlock: sequence is made odd, frame is
+written, sequence is made even again. The emulator never waits for a
+reader; a reader maps the segment, reads whatever fields it needs in
+place between shared_read_begin() and shared_read_retry(), and starts
+over if the emulator published in between.
+Input goes the other way through a single-producer single-consumer ring
+of shared_commands in the same segment: the sender fills a slot and
+publishes it by moving command_head, the emulator applies everything up
+to command_head wherever live keys are read and moves command_tail. Both
+counters only ever grow and each has a single writer, so no locks or
+compare-and-swap are involved. Commands are applied at frame boundaries.
+The functions below the export ones are the reader side, chip8-watch
+(watch.c) is an example.
+*/
+
+struct shared_export{
+    shared_segment *segment;
+    char name[256]; //Name passed to shm_open(), with the leading '/'
+    int fd;
+};
+
+//Shared memory object names are "/name", accept them with or without the slash
+static void object_name(char *out, size_t size, const char *name){
+    if(name[0] == '/'){
+        snprintf(out, size, "%s", name);
+    }else{
+        snprintf(out, size, "/%s", name);
+    }
+}
+
+shared_export *start_export(const char *name){
+    shared_export *export_ptr = calloc(1, sizeof(shared_export));
+
+    if(!export_ptr){
+        printf("Error allocating export\n");
+        exit(1);
+    }
+
+    object_name(export_ptr->name, sizeof export_ptr->name, name);
+
+    export_ptr->fd = shm_open(export_ptr->name, O_RDWR | O_CREAT | O_TRUNC, 0600);
+    if(export_ptr->fd < 0 || ftruncate(export_ptr->fd, sizeof(shared_segment)) != 0){
+        printf("Error creating shared memory %s\n", export_ptr->name);
+        exit(1);
+    }
+
+    export_ptr->segment = mmap(NULL, sizeof(shared_segment), PROT_READ | PROT_WRITE, MAP_SHARED, export_ptr->fd, 0);
+    if(export_ptr->segment == MAP_FAILED){
+        printf("Error mapping shared memory %s\n", export_ptr->name);
+        exit(1);
+    }
+
+    //ftruncate() zero-filled it; readers check the magic last, once everything else is in place
+    export_ptr->segment->version = SHARED_VERSION;
+    export_ptr->segment->size = sizeof(shared_segment);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy(export_ptr->segment->magic, "C8SM", 4);
+
+    return export_ptr;
+}
+
+void export_frame(shared_export *export_ptr, const chip8 *chip8_object_ptr){
+    shared_segment *segment = export_ptr->segment;
+    shared_frame *frame = &segment->frame;
+    __uint64_t sequence = segment->sequence;
+
+    //The odd value has to be visible before any of the stores to frame
+    __atomic_store_n(&segment->sequence, sequence + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    frame->frame = chip8_object_ptr->frames;
+    memcpy(frame->display, chip8_object_ptr->display, sizeof frame->display);
+    frame->PC = chip8_object_ptr->PC;
+    frame->I = chip8_object_ptr->I;
+    memcpy(frame->stack, chip8_object_ptr->stack, sizeof frame->stack);
+    frame->keys = chip8_object_ptr->keys;
+    frame->sp = chip8_object_ptr->sp;
+    memcpy(frame->registers, chip8_object_ptr->registers, sizeof frame->registers);
+    frame->delay_timer = chip8_object_ptr->delay_timer;
+    frame->sound_timer = chip8_object_ptr->sound_timer;
+    frame->hires = chip8_object_ptr->hires;
+    frame->planes = chip8_object_ptr->planes;
+    frame->running = (chip8_object_ptr->state == RUNNING);
+
+    __atomic_store_n(&segment->sequence, sequence + 2, __ATOMIC_RELEASE);
+}
+
+void export_commands(shared_export *export_ptr, chip8 *chip8_object_ptr){
+    shared_segment *segment = export_ptr->segment;
+    __uint32_t head = __atomic_load_n(&segment->command_head, __ATOMIC_ACQUIRE);
+    __uint32_t tail = segment->command_tail;
+
+    //A sender writing garbage into the counters can't make this loop for long
+    if(head - tail > SHARED_COMMANDS){
+        tail = head - SHARED_COMMANDS;
+    }
+
+    for(; tail != head; tail++){
+        const shared_command *command = &segment->commands[tail % SHARED_COMMANDS];
+
+        switch(command->type){
+            case SHARED_KEY_DOWN:
+                set_key(chip8_object_ptr, command->key, 1);
+                break;
+            case SHARED_KEY_UP:
+                set_key(chip8_object_ptr, command->key, 0);
+                break;
+            case SHARED_QUIT:
+                chip8_object_ptr->state = NOT_RUNNING;
+                break;
+            default:
+                break;
+        }
+    }
+
+    //The slots are free for the sender once it sees the new tail
+    __atomic_store_n(&segment->command_tail, tail, __ATOMIC_RELEASE);
+}
+
+//Publishes the final state with running cleared, readers that have the segment mapped keep it after the unlink
+void stop_export(shared_export *export_ptr, const chip8 *chip8_object_ptr){
+    export_frame(export_ptr, chip8_object_ptr);
+
+    munmap(export_ptr->segment, sizeof(shared_segment));
+    close(export_ptr->fd);
+    shm_unlink(export_ptr->name);
+    free(export_ptr);
+}
+
+//Reader side: maps an exported segment read-write (commands are written into it), NULL if there's none
+shared_segment *open_shared(const char *name){
+    char object[256];
+
+    object_name(object, sizeof object, name);
+
+    int fd = shm_open(object, O_RDWR, 0);
+    if(fd < 0) return NULL;
+
+    struct stat info;
+    if(fstat(fd, &info) != 0 || (size_t)info.st_size < sizeof(shared_segment)){
+        close(fd);
+        return NULL;
+    }
+
+    shared_segment *segment = mmap(NULL, sizeof(shared_segment), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if(segment == MAP_FAILED) return NULL;
+
+    if(memcmp(segment->magic, "C8SM", 4)){
+        munmap(segment, sizeof(shared_segment));
+        return NULL;
+    }
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+    if(segment->version != SHARED_VERSION || segment->size != sizeof(shared_segment)){
+        munmap(segment, sizeof(shared_segment));
+        return NULL;
+    }
+    return segment;
+}
+
+void close_shared(shared_segment *segment){
+    munmap(segment, sizeof(shared_segment));
+}
+
+/*
+Start of a read of segment->frame. Returns the sequence to hand to
+shared_read_retry() once the reads are done, waiting out a publish that
+is in progress. Between the two calls fields can be read straight from
+the mapping, but values may be torn: nothing read may be trusted (used
+as an index, say) until shared_read_retry() returns 0.
+*/
+__uint64_t shared_read_begin(const shared_segment *segment){
+    __uint64_t sequence;
+
+    while((sequence = __atomic_load_n(&segment->sequence, __ATOMIC_ACQUIRE)) & 1){
+        //A publish is a few kilobytes of copying, spinning is cheaper than sleeping
+    }
+    return sequence;
+}
+
+//1 if the emulator published since shared_read_begin() returned sequence, then the reads have to be redone
+int shared_read_retry(const shared_segment *segment, __uint64_t sequence){
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&segment->sequence, __ATOMIC_RELAXED) != sequence;
+}
+
+//A consistent copy of the whole frame
+void read_shared_frame(const shared_segment *segment, shared_frame *frame){
+    __uint64_t sequence;
+
+    do{
+        sequence = shared_read_begin(segment);
+        memcpy(frame, (const void *)&segment->frame, sizeof *frame);
+    }while(shared_read_retry(segment, sequence));
+}
+
+//Returns 0 when the ring is full, the emulator hasn't reached a frame boundary since the last SHARED_COMMANDS commands
+int send_shared_command(shared_segment *segment, shared_commands type, __uint8_t key){
+    __uint32_t head = segment->command_head;
+    __uint32_t tail = __atomic_load_n(&segment->command_tail, __ATOMIC_ACQUIRE);
+
+    if(head - tail >= SHARED_COMMANDS){
+        return 0;
+    }
+
+    segment->commands[head % SHARED_COMMANDS].type = type;
+    segment->commands[head % SHARED_COMMANDS].key = key & 0xf;
+    __atomic_store_n(&segment->command_head, head + 1, __ATOMIC_RELEASE);
+    return 1;
+}
@@ -0,0 +1,101 @@
+#define _DEFAULT_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "chip8.h"
+
+/*
+Binary execution trace. The trace file is a header followed by a ring of
+fixed-size trace_records, mapped into memory, so recording an instruction
+is a 24-byte store and a counter update with no system call; the kernel
+writes the pages back on its own and the file is complete even when the
+emulator crashes. The ring keeps the last capacity instructions. Every
+record is written before head is published with a release store, so a
+reader mapping the same file never sees a half-written record below head.
+Records hold the machine state debug() looks at, chip8-trace prints them
+with the same text.
+*/
+
+typedef struct trace_buffer{
+    trace_header *header; //Start of the mapping
+    trace_record *records; //Ring of capacity records after the header
+    __uint64_t capacity; //Power of two
+    __uint64_t head; //Records written, private copy of header->head
+    size_t map_size;
+    int fd;
+} trace_buffer;
+
+void start_trace(chip8 *chip8_object_ptr, const char *path, __uint64_t records){
+    trace_buffer *trace = calloc(1, sizeof(trace_buffer));
+
+    if(!trace){
+        printf("Error allocating trace\n");
+        exit(1);
+    }
+
+    //A power of two turns the ring index into a mask
+    trace->capacity = 1;
+    while(trace->capacity < records){
+        trace->capacity <<= 1;
+    }
+    trace->map_size = sizeof(trace_header) + trace->capacity * sizeof(trace_record);
+
+    trace->fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if(trace->fd < 0 || ftruncate(trace->fd, trace->map_size) != 0){
+        printf("Error creating trace %s\n", path);
+        exit(1);
+    }
+
+    trace->header = mmap(NULL, trace->map_size, PROT_READ | PROT_WRITE, MAP_SHARED, trace->fd, 0);
+    if(trace->header == MAP_FAILED){
+        printf("Error mapping trace %s\n", path);
+        exit(1);
+    }
+    trace->records = (trace_record *)(trace->header + 1);
+
+    memcpy(trace->header->magic, "C8TR", 4);
+    trace->header->version = TRACE_VERSION;
+    trace->header->record_size = sizeof(trace_record);
+    trace->header->capacity = trace->capacity;
+    trace->header->head = 0;
+
+    chip8_object_ptr->trace = trace;
+
+    //Skipped idle loop passes would be missing from the trace
+    chip8_object_ptr->skip_idle = 0;
+}
+
+void stop_trace(chip8 *chip8_object_ptr){
+    trace_buffer *trace = chip8_object_ptr->trace;
+
+    if(!trace) return;
+
+    munmap(trace->header, trace->map_size);
+
+    //The unused part of a ring that never wrapped would only be zeros
+    if(trace->head < trace->capacity){
+        if(ftruncate(trace->fd, sizeof(trace_header) + trace->head * sizeof(trace_record)) != 0){
+            printf("Error truncating trace\n");
+        }
+    }
+    close(trace->fd);
+
+    free(trace);
+    chip8_object_ptr->trace = NULL;
+}
+
+void trace_instruction(trace_buffer *trace, const chip8 *chip8_object_ptr, __uint16_t pc, __uint16_t opcode){
+    trace_record *record = &trace->records[trace->head & (trace->capacity - 1)];
+
+    record->pc = pc;
+    record->opcode = opcode;
+    record->I = chip8_object_ptr->I;
+    record->stack_top = (chip8_object_ptr->sp < STACK_SIZE) ? chip8_object_ptr->stack[chip8_object_ptr->sp] : 0;
+    memcpy(record->registers, chip8_object_ptr->registers, sizeof record->registers);
+
+    trace->head++;
+    __atomic_store_n(&trace->header->head, trace->head, __ATOMIC_RELEASE);
+}
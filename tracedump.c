@@ -0,0 +1,90 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "chip8.h"
+
+/*
+Offline decoder for traces written with --trace: prints every record, oldest
+first, as the line debug() prints for that instruction.
+*/
+
+void usage(void){
+    printf("Usage: ./chip8-trace [--last N] <trace file>\n");
+    exit(1);
+}
+
+long parse_count(const char *arg){
+    char *end;
+    long value = strtol(arg, &end, 10);
+
+    if(*arg == '\0' || *end != '\0' || value <= 0){
+        printf("Invalid count: %s\n", arg);
+        exit(1);
+    }
+    return value;
+}
+
+int main(int argc, char **argv){
+    const char *trace_name = NULL;
+    __uint64_t last = 0;
+    trace_header header;
+    trace_record record;
+
+    for(int i=1; i<argc; i++){
+        if(!strcmp(argv[i], "--last") && i + 1 < argc){
+            last = parse_count(argv[++i]);
+        }else if(argv[i][0] != '-' && !trace_name){
+            trace_name = argv[i];
+        }else{
+            usage();
+        }
+    }
+
+    if(!trace_name){
+        usage();
+    }
+
+    FILE *trace = fopen(trace_name, "rb");
+    if(trace == NULL){
+        printf("Error opening trace\n");
+        exit(1);
+    }
+
+    if(fread(&header, sizeof header, 1, trace) != 1 || memcmp(header.magic, "C8TR", 4)
+       || header.version != TRACE_VERSION || header.record_size != sizeof(trace_record)
+       || header.capacity == 0 || (header.capacity & (header.capacity - 1))){
+        printf("Not a chip8 trace: %s\n", trace_name);
+        exit(1);
+    }
+
+    //Once the ring has wrapped the oldest record sits right after the newest one
+    __uint64_t available = (header.head < header.capacity) ? header.head : header.capacity;
+    __uint64_t count = (last && last < available) ? last : available;
+    __uint64_t first = header.head - count;
+
+    if(header.head > header.capacity){
+        fprintf(stderr, "%llu older records were overwritten\n",
+            (unsigned long long)(header.head - header.capacity));
+    }
+
+    for(__uint64_t n=first; n<header.head; n++){
+        long offset = sizeof header + (n & (header.capacity - 1)) * sizeof record;
+
+        //Records are read one at a time, consecutive ones are usually adjacent so only the wrap seeks
+        if(n == first || !(n & (header.capacity - 1))){
+            if(fseek(trace, offset, SEEK_SET) != 0){
+                printf("Error seeking in trace\n");
+                exit(1);
+            }
+        }
+        if(fread(&record, sizeof record, 1, trace) != 1){
+            printf("Trace ends early, %llu records missing\n", (unsigned long long)(header.head - n));
+            exit(1);
+        }
+
+        print_instruction(stdout, record.pc, record.opcode, record.registers, record.I, record.stack_top);
+    }
+
+    fclose(trace);
+    return 0;
+}
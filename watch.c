@@ -0,0 +1,164 @@
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "chip8.h"
+
+/*
+Example reader of a segment exported with --export: prints the machine
+state of the latest frame, or one line per frame while following it, and
+sends keypad input. Everything goes through the reader functions at the
+end of shared.c, which is all another program needs to link.
+*/
+
+//Most commands one run can send
+#define MAX_COMMANDS 64
+
+//A command from the command line, taps are a press and a release a frame apart
+typedef struct{
+    shared_commands type;
+    __uint8_t key;
+    int tap;
+} request;
+
+void usage(void){
+    printf("Usage: ./chip8-watch [--follow FRAMES] [--press KEY] [--release KEY] [--tap KEY] [--quit] <name>\n");
+    exit(1);
+}
+
+long parse_count(const char *arg){
+    char *end;
+    long value = strtol(arg, &end, 10);
+
+    if(*arg == '\0' || *end != '\0' || value <= 0){
+        printf("Invalid count: %s\n", arg);
+        exit(1);
+    }
+    return value;
+}
+
+__uint8_t parse_key(const char *arg){
+    char *end;
+    long value = strtol(arg, &end, 16);
+
+    if(*arg == '\0' || *end != '\0' || value < 0 || value > 0xF){
+        printf("Invalid key (expected 0-F): %s\n", arg);
+        exit(1);
+    }
+    return value;
+}
+
+//The ring only drains at frame boundaries, wait for room rather than losing input
+void send_command(shared_segment *segment, shared_commands type, __uint8_t key){
+    while(!send_shared_command(segment, type, key)){
+        usleep(1000);
+    }
+}
+
+//Returns once the emulator has applied every command sent so far
+void wait_for_commands(const shared_segment *segment){
+    while(__atomic_load_n(&segment->command_tail, __ATOMIC_ACQUIRE) != segment->command_head){
+        usleep(1000);
+    }
+}
+
+//Returns once the emulator has published a frame after frame_number, or stopped; no frames are published while it's parked in Fx0A
+void wait_for_frame(const shared_segment *segment, __uint64_t frame_number, shared_frame *frame){
+    for(;;){
+        read_shared_frame(segment, frame);
+        if(frame->frame != frame_number || !frame->running) return;
+        usleep(1000);
+    }
+}
+
+void print_frame(const shared_frame *frame){
+    int width = frame->hires ? DISPLAY_WIDTH : LORES_WIDTH;
+    int height = frame->hires ? DISPLAY_HEIGHT : LORES_HEIGHT;
+
+    printf("frame=%llu %s PC=0x%03X I=0x%03X SP=%d DT=%u ST=%u keys=%04X\n",
+        (unsigned long long)frame->frame, frame->running ? "running" : "stopped",
+        frame->PC, frame->I, (__int8_t)frame->sp, frame->delay_timer, frame->sound_timer, frame->keys);
+
+    for(int i=0; i<16; i++){
+        printf("V%X=%02X%c", i, frame->registers[i], (i == 15) ? '\n' : ' ');
+    }
+
+    for(int y=0; y<height; y++){
+        for(int x=0; x<width; x++){
+            int bit = 63 - (x & 63);
+            int value = ((frame->display[0][y][x >> 6] >> bit) & 1) | (((frame->display[1][y][x >> 6] >> bit) & 1) << 1);
+            putchar(".#o@"[value]);
+        }
+        putchar('\n');
+    }
+}
+
+int main(int argc, char **argv){
+    const char *name = NULL;
+    long follow = 0;
+    int quit = 0;
+    request commands[MAX_COMMANDS];
+    int command_count = 0;
+
+    for(int i=1; i<argc; i++){
+        if(!strcmp(argv[i], "--follow") && i + 1 < argc){
+            follow = parse_count(argv[++i]);
+        }else if(!strcmp(argv[i], "--press") && i + 1 < argc && command_count < MAX_COMMANDS){
+            commands[command_count++] = (request){SHARED_KEY_DOWN, parse_key(argv[++i]), 0};
+        }else if(!strcmp(argv[i], "--release") && i + 1 < argc && command_count < MAX_COMMANDS){
+            commands[command_count++] = (request){SHARED_KEY_UP, parse_key(argv[++i]), 0};
+        }else if(!strcmp(argv[i], "--tap") && i + 1 < argc && command_count < MAX_COMMANDS){
+            commands[command_count++] = (request){SHARED_KEY_DOWN, parse_key(argv[++i]), 1};
+        }else if(!strcmp(argv[i], "--quit")){
+            quit = 1;
+        }else if(argv[i][0] != '-' && !name){
+            name = argv[i];
+        }else{
+            usage();
+        }
+    }
+
+    if(!name){
+        usage();
+    }
+
+    shared_segment *segment = open_shared(name);
+    if(!segment){
+        printf("No chip8 export named %s\n", name);
+        exit(1);
+    }
+
+    shared_frame frame;
+
+    for(int i=0; i<command_count; i++){
+        send_command(segment, commands[i].type, commands[i].key);
+
+        //A tap is held for two frames of wall-clock time after the emulator took it, so the ROM sees it whatever it polls with
+        if(commands[i].tap){
+            wait_for_commands(segment);
+            usleep(2 * 1000000 / TIMER_HZ);
+            send_command(segment, SHARED_KEY_UP, commands[i].key);
+        }
+    }
+
+    if(follow){
+        read_shared_frame(segment, &frame);
+        for(long i=0; i<follow && frame.running; i++){
+            wait_for_frame(segment, frame.frame, &frame);
+            printf("frame=%llu PC=0x%03X I=0x%03X DT=%u ST=%u keys=%04X\n", (unsigned long long)frame.frame,
+                frame.PC, frame.I, frame.delay_timer, frame.sound_timer, frame.keys);
+        }
+    }else{
+        read_shared_frame(segment, &frame);
+        print_frame(&frame);
+    }
+
+    if(quit){
+        send_command(segment, SHARED_QUIT, 0);
+    }
+
+    close_shared(segment);
+    return 0;
+}